@@ -0,0 +1,52 @@
+/**
+ * @file feature_flags.h
+ * @brief Compile-time feature selection
+ *
+ * Each subsystem of main.cpp is guarded by one FEATURE_* switch. A disabled
+ * feature has no code, tasks, buffers, routes or setup calls in the image,
+ * so a board only pays for what its env enables. Set them per env in
+ * platformio.ini, e.g. -DFEATURE_DASHBOARD=0. Everything defaults to on.
+ *
+ * Status records that other reports read (iperf and blast counters, the
+ * latency report) stay compiled in and read as idle when their engine is
+ * off.
+ */
+#pragma once
+
+// Embedded web dashboard (web/index.html, gzipped). Off: "/" lists the API.
+#ifndef FEATURE_DASHBOARD
+#define FEATURE_DASHBOARD 1
+#endif
+
+// Raw traffic engines: lwIP TX engine (8081), plus on ESP32 the iperf2
+// sinks (5001), UDP blast generator and the WebSocket/UDP latency engine.
+// The HTTP download/upload/ping tests do not depend on them.
+#ifndef FEATURE_TRAFFIC_ENGINES
+#define FEATURE_TRAFFIC_ENGINES 1
+#endif
+
+// Client-side tests through an upstream AP, the test sequencer and the TX
+// power sweep. The sequencer's UDP step needs FEATURE_TRAFFIC_ENGINES.
+#ifndef FEATURE_CLIENT_TESTS
+#define FEATURE_CLIENT_TESTS 1
+#endif
+
+// Background WiFi scanner, channel analyzer and channel selection.
+// Off: /api/scan is gone and the AP stays on AP_CHANNEL.
+#ifndef FEATURE_SCANNER
+#define FEATURE_SCANNER 1
+#endif
+
+// Live telemetry (/api/events) and the time-series recorder.
+#ifndef FEATURE_TELEMETRY
+#define FEATURE_TELEMETRY 1
+#endif
+
+// Persistent results log on LittleFS.
+#ifndef FEATURE_RESULTS_LOG
+#define FEATURE_RESULTS_LOG 1
+#endif
+
+#if AP_AUTO_CHANNEL && !FEATURE_SCANNER
+#error "AP_AUTO_CHANNEL needs FEATURE_SCANNER"
+#endif
@@ -0,0 +1,63 @@
+"""
+Pre-build step: embed the gzipped dashboard into the firmware.
+
+Compresses web/index.html and writes include/index_html_gz.h containing the
+bytes as a PROGMEM array plus a content hash used as the HTTP ETag. The
+header is only rewritten when the page changes, so unchanged builds stay
+incremental.
+
+Runs automatically from platformio.ini (extra_scripts = pre:...), or by hand:
+    python scripts/embed_web.py
+"""
+
+import gzip
+import hashlib
+import os
+
+SOURCE = os.path.join("web", "index.html")
+TARGET = os.path.join("include", "index_html_gz.h")
+
+
+def render_header(data, etag):
+    lines = [
+        "// Generated by scripts/embed_web.py from %s - do not edit." % SOURCE.replace(os.sep, "/"),
+        "#pragma once",
+        "#include <Arduino.h>",
+        "",
+        "#define INDEX_HTML_ETAG \"\\\"%s\\\"\"" % etag,
+        "const size_t index_html_gz_len = %d;" % len(data),
+        "const uint8_t index_html_gz[] PROGMEM = {",
+    ]
+    for i in range(0, len(data), 16):
+        chunk = data[i:i + 16]
+        lines.append("    " + ", ".join("0x%02x" % b for b in chunk) + ",")
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def embed(project_dir):
+    with open(os.path.join(project_dir, SOURCE), "rb") as f:
+        html = f.read()
+
+    # mtime=0 keeps the output byte-identical for identical input
+    data = gzip.compress(html, compresslevel=9, mtime=0)
+    etag = hashlib.sha1(html).hexdigest()[:16]
+    header = render_header(data, etag)
+
+    target = os.path.join(project_dir, TARGET)
+    if os.path.exists(target):
+        with open(target, "r") as f:
+            if f.read() == header:
+                return
+    with open(target, "w") as f:
+        f.write(header)
+    print("embed_web: %s -> %s (%d -> %d bytes, etag %s)"
+          % (SOURCE, TARGET, len(html), len(data), etag))
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    embed(env.subst("$PROJECT_DIR"))  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        embed(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
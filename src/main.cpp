@@ -40,19 +40,43 @@
  */
 
 #include <Arduino.h>
+#include "feature_flags.h"
 #ifdef ESP32
 #include <WiFi.h>
-#include <WebServer.h>
+#include <esp_idf_version.h>
 #include <esp_wifi.h>
 #else
 #include <ESP8266WiFi.h>
-#include <ESP8266WebServer.h>
 extern "C" {
 #include "user_interface.h"
 }
 #endif
+#ifdef HTTP_ASYNC_BACKEND
+#include <ESPAsyncWebServer.h>
+#elif defined(ESP32)
+#include <WebServer.h>
+#else
+#include <ESP8266WebServer.h>
+#endif
+#if FEATURE_RESULTS_LOG
+#include <LittleFS.h>
+#endif
+#include <lwip/etharp.h>
+#include <lwip/memp.h>
 #include <lwip/stats.h>
-#include <DNSServer.h>
+#include <lwip/tcp.h>
+#include <lwip/priv/tcp_priv.h>
+#include <lwip/udp.h>
+#ifdef ESP32
+#include <lwip/sockets.h>
+#include <lwip/tcpip.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/sha1.h>
+#include <mbedtls/version.h>
+#include <Preferences.h>
+#endif
+#include <algorithm>
+#include <atomic>
 
 // -------------------------------------------------------------------------
 // Configuration Constants
@@ -61,417 +85,209 @@ const char* AP_SSID = "ESP32_WiFi_Test";
 const char* AP_PASS = "12345678"; // Min 8 chars for WPA2
 const int   WEB_PORT = 80;
 
+#ifdef ESP32
+// Task layout on dual-core chips; override with build flags, e.g.
+// -DTRAFFIC_CORE=0 -DHTTP_TASK_PRIORITY=4. Single-core chips ignore the
+// core numbers and keep the cooperative loop() for HTTP.
+#ifndef CONTROL_CORE
+#define CONTROL_CORE 0          // HTTP, scanner; shared with the WiFi driver
+#endif
+#ifndef TRAFFIC_CORE
+#define TRAFFIC_CORE 1          // iperf sinks and latency engine, nothing else
+#endif
+#ifndef HTTP_TASK_PRIORITY
+#define HTTP_TASK_PRIORITY      (tskIDLE_PRIORITY + 2)
+#endif
+#ifndef TRAFFIC_TASK_PRIORITY
+#define TRAFFIC_TASK_PRIORITY   (tskIDLE_PRIORITY + 2)
+#endif
+#endif
+
+// AP channel. Build with -DAP_AUTO_CHANNEL=1 to scan at boot and start on
+// the least crowded channel instead; /api/channel can move it later.
+#ifndef AP_CHANNEL
+#define AP_CHANNEL 1
+#endif
+#ifndef AP_AUTO_CHANNEL
+#define AP_AUTO_CHANNEL 0
+#endif
+
 // -------------------------------------------------------------------------
 // Global Objects
 // -------------------------------------------------------------------------
-#ifdef ESP32
-WebServer server(WEB_PORT);
+#ifdef HTTP_ASYNC_BACKEND
+AsyncWebServer server(WEB_PORT);     // Event-driven, serves many sockets at once
+#elif defined(ESP32)
+WebServer server(WEB_PORT);          // Polled from loop(), one client at a time
 #else
 ESP8266WebServer server(WEB_PORT);
+#endif
+#ifndef ESP32
 // ESP8266 Event Handlers
+WiFiEventHandler stationConnectHandler;
 WiFiEventHandler stationDisconnectHandler;
+WiFiEventHandler stationGotIpHandler;
+WiFiEventHandler stationDhcpTimeoutHandler;
+WiFiEventHandler softAPConnectHandler;
 WiFiEventHandler softAPDisconnectHandler;
 #endif
-DNSServer dnsServer;
 volatile uint32_t disconnect_count = 0;
+bool control_tasks = false;          // HTTP moved off loop() (dual-core)
+
+/**
+ * @brief Device-side accounting for one multi-stream download test
+ *
+ * The dashboard opens N parallel /api/download requests tagged with the same
+ * session id; every stream adds to these totals so the aggregate rate can be
+ * measured at the source rather than summed from per-fetch browser timings.
+ */
+struct DownloadSession {
+    uint32_t id;          // Client-chosen tag shared by all streams
+    uint8_t  streams;     // Number of parallel flows announced
+    uint8_t  finished;    // Flows that produced their full payload
+    uint32_t start_ms;    // First byte of the first stream
+    uint32_t end_ms;      // Last byte of the last stream
+    uint64_t bytes;       // Payload produced across all streams
+    uint32_t size;        // Bytes requested per stream, 0 for a timed test
+    uint32_t chunk;       // Write size used by the streams
+    bool     sweep;       // Record the result as a sweep cell
+    uint32_t rexmit_start;
+};
+DownloadSession dl_session = {};
+const int MAX_DOWNLOAD_STREAMS = 8;
+const uint32_t MAX_TIMED_TRANSFER_MS = 60000; // Cap for duration_ms downloads
+
+/**
+ * @brief Device-side accounting for raw uploads into /api/upload/raw
+ *
+ * Timing starts at the first body chunk seen by the device, so the rate
+ * reflects client-to-AP delivery with no multipart parsing or browser-side
+ * timing in the loop. Parallel uploads sharing a session id aggregate.
+ */
+struct UploadSession {
+    uint32_t id;          // Client-chosen tag shared by all streams
+    uint8_t  streams;     // Number of parallel uploads announced
+    uint8_t  finished;    // Uploads whose body fully arrived
+    int64_t  first_us;    // Arrival of the first chunk
+    int64_t  last_us;     // Arrival of the most recent chunk
+    uint64_t bytes;       // Body bytes received across all streams
+    uint32_t first_chunk; // Bytes of the first chunk (outside the timed window)
+    uint32_t chunks;      // Body reads performed
+    uint32_t rexmit_start;
+};
+UploadSession ul_session = {};
+
+// Payload moved by every test path since boot, sampled by the recorder
+volatile uint64_t traffic_tx_bytes = 0;
+volatile uint64_t traffic_rx_bytes = 0;
+
+// Guards counters shared between the HTTP task, the tcpip thread and the
+// traffic tasks. Critical sections only ever cover a few field updates.
+#ifdef ESP32
+portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+#define STATS_LOCK()   portENTER_CRITICAL(&stats_mux)
+#define STATS_UNLOCK() portEXIT_CRITICAL(&stats_mux)
+#else
+// ESP8266 runs the network stack and the sketch in a single context
+#define STATS_LOCK()
+#define STATS_UNLOCK()
+#endif
 
 // -------------------------------------------------------------------------
 // Web Content (HTML/CSS/JS)
 // -------------------------------------------------------------------------
-// Stored in PROGMEM to save RAM
-const char index_html[] PROGMEM = R"rawliteral(
-<!DOCTYPE html>
-<html lang="en">
-<head>
-    <meta charset="UTF-8">
-    <meta name="viewport" content="width=device-width, initial-scale=1.0">
-    <title>ESP32 WiFi Diagnostic Tool</title>
-    <style>
-        :root {
-            --primary-color: #2563eb;
-            --bg-color: #f3f4f6;
-            --card-bg: #ffffff;
-            --text-color: #1f2937;
-            --border-color: #e5e7eb;
-        }
-        body {
-            font-family: 'Segoe UI', Roboto, Helvetica, Arial, sans-serif;
-            background-color: var(--bg-color);
-            color: var(--text-color);
-            margin: 0;
-            padding: 20px;
-            line-height: 1.5;
-        }
-        .container {
-            max-width: 800px;
-            margin: 0 auto;
-            background: var(--card-bg);
-            padding: 2rem;
-            border-radius: 12px;
-            box-shadow: 0 4px 6px -1px rgba(0, 0, 0, 0.1);
-        }
-        h1 { color: var(--primary-color); margin-top: 0; }
-        .card {
-            background: #f8fafc;
-            border: 1px solid var(--border-color);
-            border-radius: 8px;
-            padding: 1rem;
-            margin-bottom: 1.5rem;
-        }
-        .grid {
-            display: grid;
-            grid-template-columns: repeat(auto-fit, minmax(200px, 1fr));
-            gap: 1rem;
-        }
-        .stat-item { display: flex; flex-direction: column; }
-        .stat-label { font-size: 0.875rem; color: #6b7280; }
-        .stat-value { font-size: 1.125rem; font-weight: 600; }
-        
-        button {
-            background-color: var(--primary-color);
-            color: white;
-            border: none;
-            padding: 0.75rem 1.5rem;
-            border-radius: 6px;
-            font-weight: 600;
-            cursor: pointer;
-            transition: background-color 0.2s;
-        }
-        button:hover { background-color: #1d4ed8; }
-        button:disabled { background-color: #9ca3af; cursor: not-allowed; }
-        
-        table { width: 100%; border-collapse: collapse; margin-top: 1rem; }
-        th, td { text-align: left; padding: 0.75rem; border-bottom: 1px solid var(--border-color); }
-        th { background-color: #f1f5f9; font-weight: 600; }
-        tr:hover { background-color: #f8fafc; }
-        
-        .badge {
-            padding: 0.25rem 0.5rem;
-            border-radius: 9999px;
-            font-size: 0.75rem;
-            font-weight: 500;
-        }
-        .badge-good { background-color: #dcfce7; color: #166534; }
-        .badge-weak { background-color: #fee2e2; color: #991b1b; }
-    </style>
-</head>
-<body>
-    <div class="container">
-        <h1>WiFi Diagnostic Tool</h1>
-        
-        <div class="card">
-            <div class="grid">
-                <div class="stat-item">
-                    <span class="stat-label">AP IP Address</span>
-                    <span class="stat-value" id="ip">Loading...</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">MAC Address</span>
-                    <span class="stat-value" id="mac">Loading...</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Uptime</span>
-                    <span class="stat-value" id="uptime">0s</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Free Heap</span>
-                    <span class="stat-value" id="heap">0 KB</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">TX Power</span>
-                    <span class="stat-value" id="txpower">0 dBm</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">CPU Freq</span>
-                    <span class="stat-value" id="cpu_freq">0 MHz</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">TCP Retries</span>
-                    <span class="stat-value" id="tcprexmit">0</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Disconnects</span>
-                    <span class="stat-value" id="disconnects">0</span>
-                </div>
-            </div>
-        </div>
-
-        <div class="card">
-            <h2>Hardware Details</h2>
-            <div class="grid">
-                <div class="stat-item">
-                    <span class="stat-label">Chip Model</span>
-                    <span class="stat-value" id="chip_model">Loading...</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Revision</span>
-                    <span class="stat-value" id="chip_rev">-</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Features</span>
-                    <span class="stat-value" id="features" style="font-size:0.8rem">-</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Cores</span>
-                    <span class="stat-value" id="cores">-</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Flash Size</span>
-                    <span class="stat-value" id="flash_size">-</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Total RAM</span>
-                    <span class="stat-value" id="ram_total">-</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">PSRAM</span>
-                    <span class="stat-value" id="psram_size">-</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">SDK Version</span>
-                    <span class="stat-value" id="sdk_ver" style="font-size:0.8rem">-</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Build Date</span>
-                    <span class="stat-value" id="fw_date" style="font-size:0.8rem">-</span>
-                </div>
-            </div>
-        </div>
-
-        <div class="card">
-            <h2>Diagnostics</h2>
-            <div class="grid">
-                <div class="stat-item">
-                    <span class="stat-label">Connected Clients</span>
-                    <span class="stat-value" id="clientCount">0</span>
-                </div>
-                <div class="stat-item">
-                    <span class="stat-label">Signal Strength (RSSI)</span>
-                    <span class="stat-value" id="clientRssi">--</span>
-                </div>
-            </div>
-            <div style="margin-top: 1rem; display: flex; gap: 10px; flex-wrap: wrap;">
-                <button onclick="runPingTest()" id="btnPing">Test Latency</button>
-                <button onclick="runSpeedTest()" id="btnSpeed">Test Throughput</button>
-                <button onclick="runUploadTest()" id="btnUpload">Test Upload</button>
-            </div>
-            <div id="testResults" style="margin-top: 1rem; font-family: monospace; white-space: pre-wrap; background: #eee; padding: 10px; border-radius: 6px; display: none;"></div>
-        </div>
-
-        <div class="controls">
-            <button id="scanBtn" onclick="scanNetworks()">Scan Nearby Networks</button>
-            <span id="statusMsg" style="margin-left: 10px; color: #6b7280;"></span>
-        </div>
-
-        <div style="overflow-x: auto;">
-            <table id="wifiTable">
-                <thead>
-                    <tr>
-                        <th>SSID</th>
-                        <th>RSSI</th>
-                        <th>Channel</th>
-                        <th>Security</th>
-                    </tr>
-                </thead>
-                <tbody id="wifiList">
-                    <tr><td colspan="4" style="text-align:center">Ready to scan</td></tr>
-                </tbody>
-            </table>
-        </div>
-    </div>
-
-    <script>
-        function updateStatus() {
-            fetch('/api/status')
-                .then(res => res.json())
-                .then(data => {
-                    document.getElementById('ip').textContent = data.ip;
-                    document.getElementById('mac').textContent = data.mac;
-                    document.getElementById('uptime').textContent = formatUptime(data.uptime);
-                    document.getElementById('heap').textContent = (data.heap / 1024).toFixed(1) + ' KB';
-                    document.getElementById('txpower').textContent = data.tx_power + ' dBm';
-                    document.getElementById('cpu_freq').textContent = data.cpu_freq + ' MHz';
-                    document.getElementById('tcprexmit').textContent = data.tcp_rexmit;
-                    document.getElementById('disconnects').textContent = data.disconnects;
-                    
-                    document.getElementById('chip_model').textContent = data.chip_model;
-                    document.getElementById('chip_rev').textContent = 'v' + data.chip_rev;
-                    document.getElementById('features').textContent = data.features;
-                    document.getElementById('cores').textContent = data.cores;
-                    document.getElementById('flash_size').textContent = (data.flash_size / (1024*1024)).toFixed(2) + ' MB';
-                    document.getElementById('ram_total').textContent = data.ram_total > 0 ? (data.ram_total / 1024).toFixed(1) + ' KB' : 'N/A';
-                    document.getElementById('psram_size').textContent = data.psram_size > 0 ? (data.psram_size / (1024*1024)).toFixed(2) + ' MB' : 'None';
-                    document.getElementById('sdk_ver').textContent = data.sdk_ver;
-                    document.getElementById('fw_date').textContent = data.fw_date;
-                })
-                .catch(e => console.error('Status error:', e));
-
-            fetch('/api/clients')
-                .then(res => res.json())
-                .then(data => {
-                    document.getElementById('clientCount').textContent = data.length;
-                    if(data.length > 0) {
-                        // Show RSSI of the first connected client (likely the tester)
-                        document.getElementById('clientRssi').textContent = data[0].rssi + ' dBm';
-                    } else {
-                        document.getElementById('clientRssi').textContent = '--';
-                    }
-                })
-                .catch(e => console.error('Clients error:', e));
-        }
-
-        function formatUptime(seconds) {
-            const h = Math.floor(seconds / 3600);
-            const m = Math.floor((seconds % 3600) / 60);
-            const s = seconds % 60;
-            return `${h}h ${m}m ${s}s`;
-        }
-
-        function scanNetworks() {
-            const btn = document.getElementById('scanBtn');
-            const tbody = document.getElementById('wifiList');
-            const msg = document.getElementById('statusMsg');
-            
-            btn.disabled = true;
-            btn.textContent = 'Scanning...';
-            msg.textContent = 'Please wait...';
-            tbody.innerHTML = '<tr><td colspan="4" style="text-align:center">Scanning in progress...</td></tr>';
-
-            fetch('/api/scan')
-                .then(res => res.json())
-                .then(data => {
-                    tbody.innerHTML = '';
-                    if (data.length === 0) {
-                        tbody.innerHTML = '<tr><td colspan="4" style="text-align:center">No networks found</td></tr>';
-                    } else {
-                        data.forEach(net => {
-                            const rssiClass = net.rssi > -70 ? 'badge-good' : 'badge-weak';
-                            const row = `<tr>
-                                <td><strong>${net.ssid}</strong></td>
-                                <td><span class="badge ${rssiClass}">${net.rssi} dBm</span></td>
-                                <td>${net.channel}</td>
-                                <td>${net.auth}</td>
-                            </tr>`;
-                            tbody.innerHTML += row;
-                        });
-                    }
-                    msg.textContent = `Found ${data.length} networks`;
-                })
-                .catch(e => {
-                    console.error('Scan error:', e);
-                    tbody.innerHTML = '<tr><td colspan="4" style="text-align:center; color:red">Scan failed</td></tr>';
-                    msg.textContent = 'Error occurred';
-                })
-                .finally(() => {
-                    btn.disabled = false;
-                    btn.textContent = 'Scan Nearby Networks';
-                });
-        }
-
-        async function runPingTest() {
-            const btn = document.getElementById('btnPing');
-            const out = document.getElementById('testResults');
-            btn.disabled = true;
-            out.style.display = 'block';
-            out.textContent = 'Running Latency Test (20 packets)...\n';
-            
-            let times = [];
-            let lost = 0;
-            const count = 20;
-
-            for(let i=0; i<count; i++) {
-                const start = performance.now();
-                try {
-                    await fetch('/api/ping', {cache: "no-store"});
-                    const rtt = performance.now() - start;
-                    times.push(rtt);
-                    out.textContent += `Seq=${i+1}: ${rtt.toFixed(2)} ms\n`;
-                } catch(e) {
-                    lost++;
-                    out.textContent += `Seq=${i+1}: LOST\n`;
-                }
-                // Small delay to prevent flooding
-                await new Promise(r => setTimeout(r, 100));
-            }
-
-            if (times.length > 0) {
-                const avg = times.reduce((a, b) => a + b, 0) / times.length;
-                const min = Math.min(...times);
-                const max = Math.max(...times);
-                out.textContent += `\n--- Results ---\nPackets: ${count}, Lost: ${lost} (${(lost/count*100).toFixed(1)}%)\nRTT Min/Avg/Max: ${min.toFixed(2)} / ${avg.toFixed(2)} / ${max.toFixed(2)} ms`;
-            } else {
-                out.textContent += `\nAll packets lost.`;
-            }
-            btn.disabled = false;
-        }
-
-        async function runSpeedTest() {
-            const btn = document.getElementById('btnSpeed');
-            const out = document.getElementById('testResults');
-            btn.disabled = true;
-            out.style.display = 'block';
-            out.textContent = 'Running Download Speed Test (1 MB)...\n';
-
-            const sizeBytes = 1024 * 1024; // 1MB
-            const start = performance.now();
-            
-            try {
-                const res = await fetch('/api/download?size=' + sizeBytes);
-                const blob = await res.blob(); // Read body
-                const durationSec = (performance.now() - start) / 1000;
-                const bits = sizeBytes * 8;
-                const mbps = (bits / durationSec) / (1024 * 1024);
-                
-                out.textContent += `Transferred: ${(sizeBytes/1024).toFixed(0)} KB\nTime: ${durationSec.toFixed(2)} s\nSpeed: ${mbps.toFixed(2)} Mbps`;
-            } catch(e) {
-                out.textContent += `Error: ${e.message}`;
-            }
-            btn.disabled = false;
-        }
-
-        async function runUploadTest() {
-            const btn = document.getElementById('btnUpload');
-            const out = document.getElementById('testResults');
-            btn.disabled = true;
-            out.style.display = 'block';
-            out.textContent = 'Running Upload Speed Test (1 MB)...\n';
-
-            const sizeBytes = 1024 * 1024; // 1MB
-            const data = new Uint8Array(sizeBytes).fill(0xAA);
-            const blob = new Blob([data]);
-            const formData = new FormData();
-            formData.append("file", blob, "test.bin");
-
-            const start = performance.now();
-            try {
-                await fetch('/api/upload', { method: 'POST', body: formData });
-                const durationSec = (performance.now() - start) / 1000;
-                const bits = sizeBytes * 8;
-                const mbps = (bits / durationSec) / (1024 * 1024);
-                out.textContent += `Transferred: ${(sizeBytes/1024).toFixed(0)} KB\nTime: ${durationSec.toFixed(2)} s\nSpeed: ${mbps.toFixed(2)} Mbps`;
-            } catch(e) {
-                out.textContent += `Error: ${e.message}`;
-            }
-            btn.disabled = false;
-        }
-
-        // Initial load
-        updateStatus();
-        // Poll status every 2 seconds
-        setInterval(updateStatus, 2000);
-    </script>
-</body>
-</html>
-)rawliteral";
+// The dashboard lives in web/index.html. scripts/embed_web.py gzips it before
+// every build into include/index_html_gz.h (PROGMEM bytes + content ETag), so
+// it is stored and sent compressed. Headless builds (FEATURE_DASHBOARD=0)
+// leave it out.
+#if FEATURE_DASHBOARD
+#include "index_html_gz.h"
+#endif
 
 // -------------------------------------------------------------------------
 // Helper Functions
 // -------------------------------------------------------------------------
 
+const int TASK_REGISTRY_MAX = 16;
+
+/**
+ * @brief A task whose stack the memory profiler watches
+ */
+struct TaskRecord {
+    const char* name;
+    void*       handle;     // TaskHandle_t; NULL for the ESP8266 loop and exited tasks
+    uint32_t    stack;      // Bytes allocated, 0 if unknown (system tasks)
+};
+TaskRecord task_registry[TASK_REGISTRY_MAX];
+int task_registry_count = 0;
+
+/**
+ * @brief Add a task to the profiler's list
+ */
+void taskRegister(const char* name, void* handle, uint32_t stack) {
+    if (task_registry_count >= TASK_REGISTRY_MAX) return;
+    task_registry[task_registry_count++] = { name, handle, stack };
+}
+
+#ifdef ESP32
+/**
+ * @brief Create a task, pinned to core on dual-core chips
+ */
+bool startTask(TaskFunction_t fn, const char* name, uint32_t stack, UBaseType_t priority, BaseType_t core,
+               TaskHandle_t* handle = NULL) {
+    TaskHandle_t created = NULL;
+    bool ok;
+    if (ESP.getChipCores() > 1) {
+        ok = xTaskCreatePinnedToCore(fn, name, stack, NULL, priority, &created, core) == pdPASS;
+    } else {
+        ok = xTaskCreate(fn, name, stack, NULL, priority, &created) == pdPASS;
+    }
+    if (ok) taskRegister(name, created, stack);
+    if (handle) *handle = created;
+    return ok;
+}
+
+/**
+ * @brief Delete the calling task and drop it from the profiler's list
+ * A task that gives up (failed bind) must exit here, or the sampler would
+ * read its freed TCB. The sampler reads handles under STATS_LOCK, so the
+ * task can only be deleted once no sample is using its handle.
+ */
+void taskExit() {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    STATS_LOCK();
+    for (int i = 0; i < task_registry_count; i++) {
+        if (task_registry[i].handle == self) task_registry[i].handle = NULL;
+    }
+    STATS_UNLOCK();
+    vTaskDelete(NULL);
+}
+#endif
+
+/**
+ * @brief False once a registered task has exited
+ */
+bool taskLive(const TaskRecord& t) {
+#ifdef ESP32
+    return t.handle != NULL;
+#else
+    return true; // Only the loop is registered
+#endif
+}
+
+#ifndef ESP32
+/**
+ * @brief Microsecond clock under the ESP32 name, for the shared timing code
+ */
+int64_t esp_timer_get_time() {
+    return (int64_t)micros64();
+}
+#endif
+
 /**
  * @brief Convert WiFi encryption type to string
  */
-String translateEncryptionType(uint8_t encryptionType) {
+const char* translateEncryptionType(uint8_t encryptionType) {
 #ifdef ESP32
     switch (encryptionType) {
         case WIFI_AUTH_OPEN: return "Open";
@@ -496,291 +312,7226 @@ String translateEncryptionType(uint8_t encryptionType) {
 }
 
 /**
- * @brief WiFi Event Handler
- * Tracks disconnections to monitor stability
+ * @brief Throughput in Mbps, same convention as the dashboard (bits / s / 2^20)
  */
-#ifdef ESP32
-void onWiFiEvent(WiFiEvent_t event) {
-    if (event == ARDUINO_EVENT_WIFI_AP_STADISCONNECTED || event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
-        disconnect_count++;
-    }
+float toMbps(uint64_t bytes, int64_t durationUs) {
+    if (durationUs <= 0) return 0;
+    return (bytes * 8.0f / (1024.0f * 1024.0f)) / (durationUs / 1000000.0f);
 }
+
+/**
+ * @brief lwIP TCP retransmit counter, 0 when stats are compiled out
+ */
+uint32_t tcpRexmitCount() {
+#if LWIP_STATS && LWIP_TCP
+    return lwip_stats.tcp.rexmit;
 #else
-void onStationDisconnected(const WiFiEventStationModeDisconnected& evt) { disconnect_count++; }
-void onSoftAPDisconnected(const WiFiEventSoftAPModeStationDisconnected& evt) { disconnect_count++; }
+    return 0;
 #endif
+}
 
-// -------------------------------------------------------------------------
-// Request Handlers
-// -------------------------------------------------------------------------
+/**
+ * @brief Minimal JSON serializer over a caller-provided buffer
+ *
+ * Builds a document in place without touching the heap, so endpoints polled
+ * every few seconds do not fragment memory over long soak runs. Commas are
+ * inserted automatically; when the buffer fills up further output is dropped
+ * and overflowed() reports it.
+ *
+ *   JsonWriter w(json_buf, sizeof(json_buf));
+ *   w.beginObject().field("heap", ESP.getFreeHeap()).endObject();
+ */
+class JsonWriter {
+public:
+    JsonWriter(char* buf, size_t capacity) : _buf(buf), _cap(capacity) {
+        _buf[0] = '\0';
+    }
+
+    JsonWriter& beginObject() { open('{'); return *this; }
+    JsonWriter& endObject()   { close('}'); return *this; }
+    JsonWriter& beginArray()  { open('['); return *this; }
+    JsonWriter& endArray()    { close(']'); return *this; }
+
+    /**
+     * @brief Emit an object key; the next value call supplies its value
+     */
+    JsonWriter& key(const char* name) {
+        separator();
+        quoted(name);
+        put(':');
+        _afterKey = true;
+        return *this;
+    }
+
+    JsonWriter& value(const char* s) {
+        separator();
+        quoted(s);
+        return *this;
+    }
+    JsonWriter& value(bool b)               { return literal(b ? "true" : "false"); }
+    JsonWriter& value(int v)                { return number("%d", v); }
+    JsonWriter& value(unsigned v)           { return number("%u", v); }
+    JsonWriter& value(long v)               { return number("%ld", v); }
+    JsonWriter& value(unsigned long v)      { return number("%lu", v); }
+    JsonWriter& value(long long v)          { return number("%lld", v); }
+    JsonWriter& value(unsigned long long v) { return number("%llu", v); }
+    JsonWriter& value(double v, int decimals = 2) {
+        if (isnan(v) || isinf(v)) return literal("null");
+        separator();
+        char tmp[24];
+        snprintf(tmp, sizeof(tmp), "%.*f", decimals, v);
+        raw(tmp);
+        return *this;
+    }
+
+    /**
+     * @brief Emit "name": value
+     */
+    template <typename T>
+    JsonWriter& field(const char* name, T v) { key(name); return value(v); }
+    JsonWriter& field(const char* name, double v, int decimals) { key(name); return value(v, decimals); }
+
+    const char* c_str() const { return _buf; }
+    size_t length() const { return _len; }
+    bool overflowed() const { return _overflow; }
+
+private:
+    static const int MAX_DEPTH = 8;
+
+    void put(char c) {
+        if (_len + 1 < _cap) {
+            _buf[_len++] = c;
+            _buf[_len] = '\0';
+        } else {
+            _overflow = true;
+        }
+    }
+
+    void raw(const char* s) {
+        while (*s) put(*s++);
+    }
+
+    void quoted(const char* s) {
+        put('"');
+        for (; *s; s++) {
+            unsigned char c = *s;
+            if (c == '"' || c == '\\') {
+                put('\\');
+                put(c);
+            } else if (c < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                raw(esc);
+            } else {
+                put(c);
+            }
+        }
+        put('"');
+    }
+
+    /**
+     * @brief Comma before every element except the first in its container
+     */
+    void separator() {
+        if (_afterKey) {
+            _afterKey = false;
+            return;
+        }
+        if (_depth > 0 && !_first[_depth - 1]) put(',');
+        if (_depth > 0) _first[_depth - 1] = false;
+    }
+
+    void open(char c) {
+        separator();
+        if (_depth >= MAX_DEPTH) {
+            // Too deep to track separators; the output is unusable anyway
+            _overflow = true;
+            return;
+        }
+        put(c);
+        _first[_depth++] = true;
+    }
+
+    void close(char c) {
+        if (_depth > 0) _depth--;
+        put(c);
+    }
+
+    JsonWriter& literal(const char* s) {
+        separator();
+        raw(s);
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter& number(const char* fmt, T v) {
+        separator();
+        char tmp[24];
+        snprintf(tmp, sizeof(tmp), fmt, v);
+        raw(tmp);
+        return *this;
+    }
+
+    char*  _buf;
+    size_t _cap;
+    size_t _len = 0;
+    bool   _overflow = false;
+    bool   _afterKey = false;
+    uint8_t _depth = 0;
+    bool   _first[MAX_DEPTH];
+};
+
+// Shared response buffer, written only by route handlers. Those run one at
+// a time in a single task: the pinned "http" task on dual-core ESP32 (sync
+// backend), the AsyncTCP task (async backend), or loop() on single-core
+// chips and ESP8266. Code outside a handler must not use it.
+const size_t JSON_BUF_SIZE = 3072;
+char json_buf[JSON_BUF_SIZE];
 
 /**
- * @brief Serve the main HTML page
+ * @brief Format a MAC address as XX:XX:XX:XX:XX:XX
  */
-void handleRoot() {
-    server.send(200, "text/html", index_html);
+void formatMac(char out[18], const uint8_t* mac) {
+    snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
 
 /**
- * @brief API Endpoint: Get System Status
- * Returns JSON: { "ip": "...", "mac": "...", "uptime": 123 }
+ * @brief Format an IPv4 address as dotted quad
  */
-void handleStatus() {
-    String json = "{";
-    json += "\"ip\":\"" + WiFi.softAPIP().toString() + "\",";
-    json += "\"mac\":\"" + WiFi.macAddress() + "\",";
-    json += "\"uptime\":" + String(millis() / 1000) + ",";
-    json += "\"heap\":" + String(ESP.getFreeHeap()) + ",";
+void formatIp(char out[16], const IPAddress& ip) {
+    snprintf(out, 16, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+}
 
+/**
+ * @brief Current maximum TX power in dBm (0 where not readable)
+ */
+float currentTxPowerDbm() {
 #ifdef ESP32
     int8_t power = 0;
     esp_wifi_get_max_tx_power(&power);
-    json += "\"tx_power\":" + String(power * 0.25) + ",";
+    return power * 0.25f;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Set the maximum TX power, clamped to the 2..19.5 dBm dashboard range
+ * @return False if the driver refused it
+ */
+bool setTxPowerDbm(float dbm) {
+    dbm = constrain(dbm, 2.0f, 19.5f);
+#ifdef ESP32
+    // The driver works in 0.25 dBm steps
+    return esp_wifi_set_max_tx_power((int8_t)lroundf(dbm * 4)) == ESP_OK;
 #else
-    json += "\"tx_power\":0,";
+    WiFi.setOutputPower(dbm);
+    return true;
 #endif
-    json += "\"cpu_freq\":" + String(ESP.getCpuFreqMHz());
+}
 
+/**
+ * @brief Append the fields that never change at runtime (chip, flash, SDK)
+ */
+void writeHardwareInfo(JsonWriter& w) {
+    char text[48];
 #ifdef ESP32
     esp_chip_info_t chip_info;
     esp_chip_info(&chip_info);
-    String features = "";
-    if (chip_info.features & CHIP_FEATURE_EMB_FLASH) features += "EmbFlash, ";
-    if (chip_info.features & CHIP_FEATURE_WIFI_BGN) features += "WiFi-BGN, ";
-    if (chip_info.features & CHIP_FEATURE_BLE) features += "BLE, ";
-    if (chip_info.features & CHIP_FEATURE_BT) features += "BT, ";
-    if (chip_info.features & CHIP_FEATURE_EMB_PSRAM) features += "EmbPSRAM, ";
-    if (features.length() > 2) features = features.substring(0, features.length() - 2);
-
-    json += ",\"chip_model\":\"" + String(ESP.getChipModel()) + " (revision v" + String(chip_info.revision) + ")\"";
-    json += ",\"chip_rev\":" + String(chip_info.revision);
-    json += ",\"features\":\"" + features + "\"";
-    json += ",\"cores\":" + String(ESP.getChipCores());
-    json += ",\"ram_total\":" + String(ESP.getHeapSize());
-    json += ",\"psram_size\":" + String(ESP.getPsramSize());
-#else
-    json += ",\"chip_model\":\"ESP8266\"";
-    json += ",\"chip_rev\":0";
-    json += ",\"features\":\"WiFi\"";
-    json += ",\"cores\":1";
-    json += ",\"ram_total\":0";
-    json += ",\"psram_size\":0";
-#endif
-    json += ",\"flash_size\":" + String(ESP.getFlashChipSize());
-    json += ",\"sdk_ver\":\"" + String(ESP.getSdkVersion()) + "\"";
-    json += ",\"fw_date\":\"" + String(__DATE__) + " " + String(__TIME__) + "\"";
-    
-    #if LWIP_STATS && LWIP_TCP
-    json += ",\"tcp_rexmit\":" + String(lwip_stats.tcp.rexmit);
-    #endif
-    json += ",\"disconnects\":" + String(disconnect_count);
-    json += "}";
-    server.send(200, "application/json", json);
+    text[0] = '\0';
+    if (chip_info.features & CHIP_FEATURE_EMB_FLASH) strcat(text, "EmbFlash, ");
+    if (chip_info.features & CHIP_FEATURE_WIFI_BGN) strcat(text, "WiFi-BGN, ");
+    if (chip_info.features & CHIP_FEATURE_BLE) strcat(text, "BLE, ");
+    if (chip_info.features & CHIP_FEATURE_BT) strcat(text, "BT, ");
+    if (chip_info.features & CHIP_FEATURE_EMB_PSRAM) strcat(text, "EmbPSRAM, ");
+    size_t len = strlen(text);
+    if (len > 2) text[len - 2] = '\0';
+    w.field("features", text);
+
+    snprintf(text, sizeof(text), "%s (revision v%d)", ESP.getChipModel(), chip_info.revision);
+    w.field("chip_model", text);
+    w.field("chip_rev", chip_info.revision);
+    w.field("cores", ESP.getChipCores());
+    w.field("ram_total", ESP.getHeapSize());
+    w.field("psram_size", ESP.getPsramSize());
+#else
+    w.field("chip_model", "ESP8266");
+    w.field("chip_rev", 0);
+    w.field("features", "WiFi");
+    w.field("cores", 1);
+    w.field("ram_total", 0);
+    w.field("psram_size", 0);
+#endif
+    w.field("flash_size", ESP.getFlashChipSize());
+    w.field("sdk_ver", ESP.getSdkVersion());
+    w.field("fw_date", __DATE__ " " __TIME__);
 }
 
+const int MAX_STATIONS = 10;  // Soft-AP association limit
+
 /**
- * @brief API Endpoint: Scan WiFi Networks
- * Performs a blocking scan and returns JSON array of networks
+ * @brief One station associated with the soft-AP
  */
-void handleScan() {
-    // Perform scan
-    int n = WiFi.scanNetworks();
-    
-    String json = "[";
-    for (int i = 0; i < n; ++i) {
-        if (i > 0) json += ",";
-        json += "{";
-        json += "\"ssid\":\"" + WiFi.SSID(i) + "\",";
-        json += "\"rssi\":" + String(WiFi.RSSI(i)) + ",";
-        json += "\"channel\":" + String(WiFi.channel(i)) + ",";
-        json += "\"auth\":\"" + translateEncryptionType(WiFi.encryptionType(i)) + "\"";
-        json += "}";
-    }
-    json += "]";
-    
-    server.send(200, "application/json", json);
-    WiFi.scanDelete(); // Clean up RAM
-}
+struct StationInfo {
+    uint8_t mac[6];
+    int8_t  rssi;       // 0 where the SDK does not report it (ESP8266)
+    uint8_t phy;        // Negotiated modes, WIFI_PROTOCOL_* bits (ESP32)
+};
 
 /**
- * @brief API Endpoint: Ping
- * Used for latency testing. Returns simple timestamp.
+ * @brief Read the current soft-AP station list
+ * @return Number of entries written to out
  */
-void handlePing() {
-    server.send(200, "text/plain", String(millis()));
+int readStations(StationInfo* out, int max) {
+    int n = 0;
+#ifdef ESP32
+    wifi_sta_list_t wifi_sta_list;
+    if (esp_wifi_ap_get_sta_list(&wifi_sta_list) != ESP_OK) return 0;
+    for (int i = 0; i < wifi_sta_list.num && n < max; i++, n++) {
+        memcpy(out[n].mac, wifi_sta_list.sta[i].mac, 6);
+        out[n].rssi = wifi_sta_list.sta[i].rssi;
+        const wifi_sta_info_t& sta = wifi_sta_list.sta[i];
+        out[n].phy = (sta.phy_11b ? WIFI_PROTOCOL_11B : 0) | (sta.phy_11g ? WIFI_PROTOCOL_11G : 0) |
+                     (sta.phy_11n ? WIFI_PROTOCOL_11N : 0) | (sta.phy_lr ? WIFI_PROTOCOL_LR : 0);
+    }
+#else
+    struct station_info *stat_info = wifi_softap_get_station_info();
+    while (stat_info != NULL && n < max) {
+        memcpy(out[n].mac, stat_info->bssid, 6);
+        out[n].rssi = 0; // RSSI not available in standard AP mode on ESP8266
+        out[n].phy = 0;
+        n++;
+        stat_info = STAILQ_NEXT(stat_info, next);
+    }
+    wifi_softap_free_station_info();
+#endif
+    return n;
 }
 
+// -------------------------------------------------------------------------
+// WiFi Event Timeline
+// -------------------------------------------------------------------------
+// Every WiFi event is stamped in microseconds (esp_timer, the recorder's
+// clock) and kept in a ring of TIMELINE_SIZE entries. Disconnects keep
+// their reason code and stations their MAC, so a throughput drop in the
+// recorder can be matched to the event that caused it. The first entry
+// after boot holds the reset reason; a brownout reset usually points at the
+// supply rather than the radio.
+//
+// The event callback is the only writer and never blocks. Each entry
+// carries its sequence number, written last; a reader that sees a different
+// number after copying an entry lost it to an overwrite and skips it.
+
+const int TIMELINE_SIZE = 128;
+const int TIMELINE_PAGE = 24;               // Entries per /api/timeline response
+const uint16_t TIMELINE_BOOT = 0xFFFF;      // Pseudo-event: reset reason
+
 /**
- * @brief API Endpoint: Download Test
- * Sends a stream of dummy data to test throughput.
- * Query Param: size (bytes), default 1MB
+ * @brief One timeline entry
  */
-void handleDownload() {
-    size_t size = 1024 * 1024; // Default 1MB
-    if (server.hasArg("size")) {
-        size = server.arg("size").toInt();
-    }
+struct TimelineEntry {
+    std::atomic<uint32_t> seq;  // 1-based; 0 while being written
+    int64_t  t_us;
+    uint16_t event;             // arduino_event_id_t, WiFiEvent_t (ESP8266) or TIMELINE_BOOT
+    uint16_t reason;            // Disconnect reason, or reset reason for TIMELINE_BOOT
+    uint8_t  mac[6];            // Station (AP events) or BSSID (STA events)
+    uint8_t  aid;
+};
+TimelineEntry timeline[TIMELINE_SIZE];
+std::atomic<uint32_t> timeline_count(0);    // Entries ever written
+bool boot_brownout = false;
 
-    // Send headers
-    server.setContentLength(size);
-    server.send(200, "application/octet-stream", "");
+/**
+ * @brief Append one event; single writer (the WiFi event task)
+ */
+void timelineAdd(uint16_t event, uint16_t reason = 0, const uint8_t* mac = NULL, uint8_t aid = 0) {
+    uint32_t seq = timeline_count.load(std::memory_order_relaxed) + 1;
+    TimelineEntry& e = timeline[(seq - 1) % TIMELINE_SIZE];
+    e.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.t_us = esp_timer_get_time();
+    e.event = event;
+    e.reason = reason;
+    if (mac) memcpy(e.mac, mac, 6);
+    else memset(e.mac, 0, 6);
+    e.aid = aid;
+    e.seq.store(seq, std::memory_order_release);
+    timeline_count.store(seq, std::memory_order_release);
+}
 
-    // Send data in chunks
-    uint8_t buf[4096]; // Use a larger buffer (4K) for better performance
-    memset(buf, 0xAA, sizeof(buf)); 
-    
-    size_t sent = 0;
-    WiFiClient client = server.client();
-    client.setNoDelay(true); // Disable Nagle Algorithm for lower latency
-    
-    while (sent < size && client.connected()) {
-        size_t toSend = (size - sent) > sizeof(buf) ? sizeof(buf) : (size - sent);
-        
-        // Capture actual bytes written. If buffer is full, this returns 0.
-        size_t written = client.write(buf, toSend);
-        
-        if (written > 0) {
-            sent += written;
-        } else {
-            // Buffer is full, give the LwIP stack a moment to drain
-            delay(1);
-        }
-    }
+/**
+ * @brief Copy the entry with sequence number seq
+ * @return False if it was overwritten (or is being written) meanwhile
+ */
+bool timelineRead(uint32_t seq, TimelineEntry& out) {
+    const TimelineEntry& e = timeline[(seq - 1) % TIMELINE_SIZE];
+    if (e.seq.load(std::memory_order_acquire) != seq) return false;
+    out.t_us = e.t_us;
+    out.event = e.event;
+    out.reason = e.reason;
+    memcpy(out.mac, e.mac, 6);
+    out.aid = e.aid;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return e.seq.load(std::memory_order_relaxed) == seq;
 }
 
 /**
- * @brief API Endpoint: Upload Test
- * Receives data to test upload throughput.
+ * @brief Reset reason of this boot, as the SDK numbers it
  */
-void handleUpload() {
-    server.send(200, "text/plain", "OK");
+uint16_t bootResetReason() {
+#ifdef ESP32
+    return esp_reset_reason();
+#else
+    return ESP.getResetInfoPtr()->reason;
+#endif
 }
 
 /**
- * @brief API Endpoint: Get Connected Clients (AP Mode)
- * Returns JSON array of connected stations with RSSI.
+ * @brief Name of a reset reason
  */
-void handleClients() {
+const char* resetReasonName(uint16_t reason) {
 #ifdef ESP32
-    wifi_sta_list_t wifi_sta_list;
-    esp_wifi_ap_get_sta_list(&wifi_sta_list);
-
-    String json = "[";
-    for (int i = 0; i < wifi_sta_list.num; i++) {
-        if (i > 0) json += ",";
-        json += "{";
-        
-        // Format MAC
-        char macStr[18];
-        uint8_t *mac = wifi_sta_list.sta[i].mac;
-        sprintf(macStr, "%02X:%02X:%02X:%02X:%02X:%02X", 
-                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-        
-        json += "\"mac\":\"" + String(macStr) + "\",";
-        json += "\"rssi\":" + String(wifi_sta_list.sta[i].rssi);
-        json += "}";
+    switch (reason) {
+        case ESP_RST_POWERON:   return "power_on";
+        case ESP_RST_EXT:       return "external";
+        case ESP_RST_SW:        return "software";
+        case ESP_RST_PANIC:     return "panic";
+        case ESP_RST_INT_WDT:   return "interrupt_wdt";
+        case ESP_RST_TASK_WDT:  return "task_wdt";
+        case ESP_RST_WDT:       return "wdt";
+        case ESP_RST_DEEPSLEEP: return "deep_sleep";
+        case ESP_RST_BROWNOUT:  return "brownout";
+        case ESP_RST_SDIO:      return "sdio";
+        default:                return "unknown";
     }
-    json += "]";
 #else
-    struct station_info *stat_info = wifi_softap_get_station_info();
-    String json = "[";
-    while (stat_info != NULL) {
-        if (json.length() > 1) json += ",";
-        json += "{";
-        char macStr[18];
-        sprintf(macStr, "%02X:%02X:%02X:%02X:%02X:%02X", 
-                stat_info->bssid[0], stat_info->bssid[1], stat_info->bssid[2], 
-                stat_info->bssid[3], stat_info->bssid[4], stat_info->bssid[5]);
-        json += "\"mac\":\"" + String(macStr) + "\",";
-        json += "\"rssi\":0"; // RSSI not available in standard AP mode on ESP8266
-        json += "}";
-        stat_info = STAILQ_NEXT(stat_info, next);
+    switch (reason) {
+        case REASON_DEFAULT_RST:      return "power_on";
+        case REASON_WDT_RST:          return "wdt";
+        case REASON_EXCEPTION_RST:    return "exception";
+        case REASON_SOFT_WDT_RST:     return "soft_wdt";
+        case REASON_SOFT_RESTART:     return "software";
+        case REASON_DEEP_SLEEP_AWAKE: return "deep_sleep";
+        case REASON_EXT_SYS_RST:      return "external";
+        default:                      return "unknown";
     }
-    wifi_softap_free_station_info();
-    json += "]";
 #endif
-    server.send(200, "application/json", json);
 }
 
 /**
- * @brief Handle 404 errors
+ * @brief Name of a timeline event
  */
-void handleNotFound() {
-    if (server.hostHeader() != WiFi.softAPIP().toString()) {
-        server.sendHeader("Location", String("http://") + WiFi.softAPIP().toString(), true);
-        server.send(302, "text/plain", "");
-    } else {
-        server.send(404, "text/plain", "404: Not Found");
+const char* timelineEventName(uint16_t event) {
+    if (event == TIMELINE_BOOT) return "boot";
+#ifdef ESP32
+    return WiFi.eventName((arduino_event_id_t)event);
+#else
+    switch (event) {
+        case WIFI_EVENT_STAMODE_CONNECTED:        return "STA_CONNECTED";
+        case WIFI_EVENT_STAMODE_DISCONNECTED:     return "STA_DISCONNECTED";
+        case WIFI_EVENT_STAMODE_GOT_IP:           return "STA_GOT_IP";
+        case WIFI_EVENT_STAMODE_DHCP_TIMEOUT:     return "STA_DHCP_TIMEOUT";
+        case WIFI_EVENT_SOFTAPMODE_STACONNECTED:  return "AP_STACONNECTED";
+        case WIFI_EVENT_SOFTAPMODE_STADISCONNECTED: return "AP_STADISCONNECTED";
+        default:                                  return "unknown";
     }
+#endif
 }
 
-// -------------------------------------------------------------------------
-// Main Setup & Loop
-// -------------------------------------------------------------------------
-
-void setup() {
-    // Initialize Serial for debugging
-    Serial.begin(115200);
-    delay(1000);
-    Serial.println("\n\n--- ESP32 WiFi Tester Starting ---");
-
-    // Register Event Handler
+/**
+ * @brief Record the reset reason as the first timeline entry
+ */
+void startTimeline() {
+    uint16_t reason = bootResetReason();
 #ifdef ESP32
-    WiFi.onEvent(onWiFiEvent);
-#else
-    stationDisconnectHandler = WiFi.onStationModeDisconnected(onStationDisconnected);
-    softAPDisconnectHandler = WiFi.onSoftAPModeStationDisconnected(onSoftAPDisconnected);
+    boot_brownout = reason == ESP_RST_BROWNOUT;
 #endif
+    timelineAdd(TIMELINE_BOOT, reason);
+    Serial.printf("Reset reason: %s\n", resetReasonName(reason));
+}
 
-    // Set WiFi Mode to AP_STA (Access Point + Station)
-    // Station mode is required for scanning to work properly while AP is active
-    WiFi.mode(WIFI_AP_STA);
-
-    // Disable WiFi Power Save Mode to maximize throughput
+/**
+ * @brief WiFi Event Handler
+ * Tracks disconnections to monitor stability and records every event on
+ * the timeline
+ */
 #ifdef ESP32
-    WiFi.setSleep(false);
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+            disconnect_count++;
+            timelineAdd(event, info.wifi_sta_disconnected.reason, info.wifi_sta_disconnected.bssid);
+            break;
+        case ARDUINO_EVENT_WIFI_AP_STADISCONNECTED:
+            disconnect_count++;
+            timelineAdd(event, 0, info.wifi_ap_stadisconnected.mac, info.wifi_ap_stadisconnected.aid);
+            break;
+        case ARDUINO_EVENT_WIFI_AP_STACONNECTED:
+            timelineAdd(event, 0, info.wifi_ap_staconnected.mac, info.wifi_ap_staconnected.aid);
+            break;
+        case ARDUINO_EVENT_WIFI_AP_STAIPASSIGNED:
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+            timelineAdd(event, 0, info.wifi_ap_staipassigned.mac);
 #else
-    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+            timelineAdd(event); // IDF 4.4 reports only the IP
 #endif
-
-    // Configure Access Point
-    Serial.print("Setting up Access Point... ");
-    if (WiFi.softAP(AP_SSID, AP_PASS)) {
-        Serial.println("Success");
-        Serial.print("AP IP Address: ");
-        Serial.println(WiFi.softAPIP());
-        Serial.print("SSID: ");
-        Serial.println(AP_SSID);
-    } else {
-        Serial.println("Failed!");
+            break;
+        default:
+            timelineAdd(event);
+            break;
     }
+}
+#else
+void onStationConnected(const WiFiEventStationModeConnected& evt) {
+    timelineAdd(WIFI_EVENT_STAMODE_CONNECTED, 0, evt.bssid);
+}
+void onStationDisconnected(const WiFiEventStationModeDisconnected& evt) {
+    disconnect_count++;
+    timelineAdd(WIFI_EVENT_STAMODE_DISCONNECTED, evt.reason, evt.bssid);
+}
+void onStationGotIp(const WiFiEventStationModeGotIP& evt) { timelineAdd(WIFI_EVENT_STAMODE_GOT_IP); }
+void onStationDhcpTimeout() { timelineAdd(WIFI_EVENT_STAMODE_DHCP_TIMEOUT); }
+void onSoftAPConnected(const WiFiEventSoftAPModeStationConnected& evt) {
+    timelineAdd(WIFI_EVENT_SOFTAPMODE_STACONNECTED, 0, evt.mac, evt.aid);
+}
+void onSoftAPDisconnected(const WiFiEventSoftAPModeStationDisconnected& evt) {
+    disconnect_count++;
+    timelineAdd(WIFI_EVENT_SOFTAPMODE_STADISCONNECTED, 0, evt.mac, evt.aid);
+}
+#endif
 
-    // Start DNS Server for Captive Portal (redirects all domains to this IP)
-    dnsServer.start(53, "*", WiFi.softAPIP());
+// -------------------------------------------------------------------------
+// Boot Timing
+// -------------------------------------------------------------------------
+// Milestones of setup() on the esp_timer clock, which starts at reset.
+// Printed once at the end of setup() and reported by /api/status, so a
+// change that slows startup shows up as a larger gap between two stages.
 
-    // Setup Web Server Routes
-    server.on("/", HTTP_GET, handleRoot);
-    server.on("/api/status", HTTP_GET, handleStatus);
-    server.on("/api/scan", HTTP_GET, handleScan);
-    server.on("/api/ping", HTTP_GET, handlePing);
-    server.on("/api/download", HTTP_GET, handleDownload);
-    server.on("/api/upload", HTTP_POST, handleUpload, []() { server.upload(); });
-    server.on("/api/clients", HTTP_GET, handleClients);
-    server.onNotFound(handleNotFound);
+/**
+ * @brief Microseconds since reset at each boot milestone (0 = not reached)
+ */
+struct BootTimes {
+    int64_t setup_us;       // setup() entered (bootloader, SDK init)
+    int64_t ap_us;          // softAP up, beacons on air
+    int64_t http_us;        // HTTP server listening
+    int64_t ready_us;       // setup() returned
+};
+BootTimes boot_times = {};
 
-    // Start Server
-    server.begin();
-    Serial.println("HTTP server started");
+/**
+ * @brief Print the boot breakdown, one line per stage
+ */
+void bootTimesPrint() {
+    const BootTimes& b = boot_times;
+    Serial.printf("Boot: setup %lld ms, AP up +%lld ms, HTTP +%lld ms, ready +%lld ms (total %lld ms)\n",
+                  b.setup_us / 1000, (b.ap_us - b.setup_us) / 1000, (b.http_us - b.ap_us) / 1000,
+                  (b.ready_us - b.http_us) / 1000, b.ready_us / 1000);
 }
 
-void loop() {
-    // Process DNS requests
-    dnsServer.processNextRequest();
+// -------------------------------------------------------------------------
+// Memory Profiler
+// -------------------------------------------------------------------------
+// Tracks free heap, the largest free block (fragmentation) and the stack
+// high-water mark of every task started through startTask(), plus the
+// loop and system tasks (tcpip, WiFi, esp_timer, AsyncTCP). Heap is sampled
+// on each recorder tick (100 ms by default). Stacks are sampled at most once
+// per MEMPROF_STACK_INTERVAL_MS, since measuring one means scanning its fill
+// pattern. Each test run (see netstatsMark()) opens a new window, so
+// /api/memory shows the low points of the current run and of the run before
+// it next to the since-boot values.
+//
+// On ESP32 the IDF reports stack high-water marks in bytes. On ESP8266 the
+// only stack is the loop's cont stack.
 
-    // Handle incoming client requests
-    server.handleClient();
-    
-    // Add a small delay to prevent CPU hogging if needed, 
-    // though handleClient is usually sufficient.
-    delay(2); 
+const uint32_t MEMPROF_STACK_INTERVAL_MS = 1000;
+
+/**
+ * @brief Low points over one window (since boot, or one test run)
+ */
+struct MemWindow {
+    const char* run;
+    uint32_t start_ms;
+    uint32_t end_ms;                        // 0 while open
+    uint32_t samples;
+    uint32_t min_free;
+    uint32_t min_largest;
+    uint32_t stack_start[TASK_REGISTRY_MAX]; // Free stack when the window opened
+    uint32_t stack_free[TASK_REGISTRY_MAX];  // Free stack at the latest sample
+};
+MemWindow mem_boot = {};
+MemWindow mem_run = {};
+MemWindow mem_last_run = {};
+uint32_t mem_stack_ms = 0;
+bool mem_profiling = false;     // Set once startMemoryProfiler() has run
+
+/**
+ * @brief Largest block malloc() can hand out right now
+ */
+uint32_t heapLargestBlock() {
+#ifdef ESP32
+    return ESP.getMaxAllocHeap();
+#else
+    return ESP.getMaxFreeBlockSize();
+#endif
+}
+
+/**
+ * @brief Minimum free stack a task has had since it started, in bytes
+ * Call under STATS_LOCK: taskExit() clears the handle under the same lock
+ * before deleting, so a non-NULL handle stays valid for the whole call.
+ */
+uint32_t taskStackFree(const TaskRecord& t) {
+#ifdef ESP32
+    if (!t.handle) return 0; // Exited; never pass NULL, that means "self"
+    return uxTaskGetStackHighWaterMark((TaskHandle_t)t.handle);
+#else
+    return ESP.getFreeContStack();
+#endif
+}
+
+/**
+ * @brief Reset a window to the current values
+ */
+void memWindowOpen(MemWindow& w, const char* run) {
+    w = {};
+    w.run = run;
+    w.start_ms = millis();
+    w.min_free = ESP.getFreeHeap();
+    w.min_largest = heapLargestBlock();
+    STATS_LOCK();
+    for (int i = 0; i < task_registry_count; i++) {
+        w.stack_start[i] = w.stack_free[i] = taskStackFree(task_registry[i]);
+    }
+    STATS_UNLOCK();
+}
+
+/**
+ * @brief Close the running window and open one for a new test run
+ */
+void memprofMark(const char* run) {
+    STATS_LOCK();
+    mem_last_run = mem_run;
+    mem_last_run.end_ms = millis();
+    STATS_UNLOCK();
+    MemWindow w;
+    memWindowOpen(w, run);
+    STATS_LOCK();
+    mem_run = w;
+    STATS_UNLOCK();
+}
+
+/**
+ * @brief Fold one sample into the boot and run windows
+ * Called from recorderSample().
+ */
+void memprofSample() {
+    if (!mem_profiling) return;
+    uint32_t free = ESP.getFreeHeap();
+    uint32_t largest = heapLargestBlock();
+    uint32_t now = millis();
+    bool stacks = now - mem_stack_ms >= MEMPROF_STACK_INTERVAL_MS;
+    uint32_t stackFree[TASK_REGISTRY_MAX];
+    bool live[TASK_REGISTRY_MAX];
+    int tasks = task_registry_count;
+    if (stacks) {
+        mem_stack_ms = now;
+        STATS_LOCK();
+        for (int i = 0; i < tasks; i++) {
+            live[i] = taskLive(task_registry[i]);
+            stackFree[i] = live[i] ? taskStackFree(task_registry[i]) : 0;
+        }
+        STATS_UNLOCK();
+    }
+
+    STATS_LOCK();
+    MemWindow* windows[] = { &mem_boot, &mem_run };
+    for (MemWindow* w : windows) {
+        w->samples++;
+        if (free < w->min_free) w->min_free = free;
+        if (largest < w->min_largest) w->min_largest = largest;
+        if (!stacks) continue;
+        for (int i = 0; i < tasks; i++) {
+            if (!live[i]) continue; // Exited; keep its last values
+            // Registered after this window opened
+            if (w->stack_start[i] == 0) w->stack_start[i] = stackFree[i];
+            w->stack_free[i] = stackFree[i];
+        }
+    }
+    STATS_UNLOCK();
+}
+
+/**
+ * @brief Register the loop and system tasks and open the boot window
+ * Call at the end of setup(), once every task exists.
+ */
+void startMemoryProfiler() {
+#ifdef ESP32
+    if (!control_tasks) {
+        // loop() deletes its own task when the control tasks took over
+#ifdef CONFIG_ARDUINO_LOOP_STACK_SIZE
+        taskRegister("loopTask", xTaskGetCurrentTaskHandle(), CONFIG_ARDUINO_LOOP_STACK_SIZE);
+#else
+        taskRegister("loopTask", xTaskGetCurrentTaskHandle(), 0);
+#endif
+    }
+    const char* system[] = { "tiT", "wifi", "esp_timer", "async_tcp" };
+    for (const char* name : system) {
+        TaskHandle_t h = xTaskGetHandle(name);
+        if (h) taskRegister(name, h, 0);
+    }
+#else
+    taskRegister("loop", NULL, 4096);
+#endif
+    memWindowOpen(mem_boot, "boot");
+    memWindowOpen(mem_run, "boot");
+    mem_profiling = true;
+}
+
+#if !FEATURE_TELEMETRY
+/**
+ * @brief Sample heap low points without the recorder
+ * Called from loop() and httpTask(); the recorder's timer does this when
+ * FEATURE_TELEMETRY is on.
+ */
+void memprofService() {
+    static uint32_t last_ms = 0;
+    uint32_t now = millis();
+    if (now - last_ms < 100) return;
+    last_ms = now;
+    memprofSample();
+}
+#endif
+
+/**
+ * @brief Write a window's heap low points as "key": {...}
+ */
+void writeMemWindow(JsonWriter& w, const char* key, const MemWindow& win) {
+    w.key(key).beginObject();
+    w.field("run", win.run ? win.run : "");
+    w.field("duration_ms", (win.end_ms ? win.end_ms : millis()) - win.start_ms);
+    w.field("samples", win.samples);
+    w.field("min_free", win.min_free);
+    w.field("min_largest", win.min_largest);
+    w.endObject();
+}
+
+// -------------------------------------------------------------------------
+// Network Statistics (lwIP)
+// -------------------------------------------------------------------------
+// Global lwIP counters, memory-pool usage and per-connection TCP state for
+// /api/netstats. Each new test run (download or upload session, iperf run,
+// latency run) marks the counters, so the endpoint can also report what
+// changed during the run. The global counters need LWIP_STATS in the lwIP
+// build; per-connection state is always available.
+//
+// tcp_pcb fields belong to the tcpip thread, so snapshots are taken there.
+// lwIP measures RTT in slow-timer ticks (TCP_SLOW_INTERVAL, 500 ms), so
+// srtt_ms and rto_ms are coarse.
+
+#if LWIP_STATS
+typedef decltype(lwip_stats.tcp.xmit) NetCounterValue;
+
+/**
+ * @brief A named lwIP protocol counter
+ */
+struct NetCounter {
+    const char* name;
+    const NetCounterValue* value;
+};
+
+const NetCounter NET_COUNTERS[] = {
+#if LINK_STATS
+    { "link_xmit", &lwip_stats.link.xmit },     { "link_recv", &lwip_stats.link.recv },
+    { "link_drop", &lwip_stats.link.drop },     { "link_memerr", &lwip_stats.link.memerr },
+#endif
+#if IP_STATS
+    { "ip_xmit", &lwip_stats.ip.xmit },         { "ip_recv", &lwip_stats.ip.recv },
+    { "ip_drop", &lwip_stats.ip.drop },         { "ip_err", &lwip_stats.ip.err },
+#endif
+#if UDP_STATS
+    { "udp_xmit", &lwip_stats.udp.xmit },       { "udp_recv", &lwip_stats.udp.recv },
+    { "udp_drop", &lwip_stats.udp.drop },       { "udp_memerr", &lwip_stats.udp.memerr },
+#endif
+#if TCP_STATS
+    { "tcp_xmit", &lwip_stats.tcp.xmit },       { "tcp_recv", &lwip_stats.tcp.recv },
+    { "tcp_drop", &lwip_stats.tcp.drop },       { "tcp_rexmit", &lwip_stats.tcp.rexmit },
+    { "tcp_chkerr", &lwip_stats.tcp.chkerr },   { "tcp_memerr", &lwip_stats.tcp.memerr },
+    { "tcp_rterr", &lwip_stats.tcp.rterr },     { "tcp_proterr", &lwip_stats.tcp.proterr },
+    { "tcp_err", &lwip_stats.tcp.err },
+#endif
+};
+const int NET_COUNTER_COUNT = sizeof(NET_COUNTERS) / sizeof(NET_COUNTERS[0]);
+
+#if MEMP_STATS
+// Pool names in memp_t order, generated from lwIP's own pool list
+const char* const MEMP_NAMES[] = {
+#define LWIP_MEMPOOL(name, num, size, desc) #name,
+#include "lwip/priv/memp_std.h"
+};
+#endif
+#endif
+
+/**
+ * @brief Counter values at the start of the current test run
+ */
+struct NetMark {
+    const char* run;        // Test type that set the mark
+    uint32_t    at_ms;
+#if LWIP_STATS
+    uint32_t    counters[NET_COUNTER_COUNT];
+#if MEMP_STATS
+    uint32_t    memp_err[MEMP_MAX];
+#endif
+#endif
+};
+NetMark net_mark = { "boot", 0 };
+
+/**
+ * @brief Start a new before/after window for /api/netstats
+ */
+void netstatsMark(const char* run) {
+    memprofMark(run);
+    net_mark.run = run;
+    net_mark.at_ms = millis();
+#if LWIP_STATS
+    for (int i = 0; i < NET_COUNTER_COUNT; i++) net_mark.counters[i] = *NET_COUNTERS[i].value;
+#if MEMP_STATS
+    for (int i = 0; i < MEMP_MAX; i++) net_mark.memp_err[i] = lwip_stats.memp[i] ? lwip_stats.memp[i]->err : 0;
+#endif
+#endif
+}
+
+/**
+ * @brief TCP state of one connection, copied out of its tcp_pcb
+ */
+struct PcbSnapshot {
+    uint32_t remote_ip;
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint8_t  state;
+    uint8_t  nrtx;          // Retransmissions of the current segment
+    uint8_t  dupacks;
+    bool     fast_recovery;
+    uint16_t mss;
+    uint16_t snd_queuelen;  // Segments queued for sending
+    uint16_t ooseq;         // Segments held out of sequence
+    uint32_t cwnd, ssthresh, snd_wnd, rcv_wnd, snd_buf;
+    uint32_t srtt_ms, rto_ms;
+};
+
+const int NETSTATS_MAX_PCBS = 8;
+
+/**
+ * @brief A set of connection snapshots taken at one instant
+ */
+struct PcbTable {
+    uint32_t    taken_ms;
+    uint8_t     count;
+    uint16_t    port_a;     // Local ports to keep, 0 keeps everything
+    uint16_t    port_b;
+    PcbSnapshot pcbs[NETSTATS_MAX_PCBS];
+};
+PcbTable pcb_live = {};         // Filled on demand for /api/netstats/pcbs
+PcbTable pcb_download = {};     // Taken as each download stream finishes
+
+/**
+ * @brief A pending snapshot handed to the tcpip thread
+ */
+struct PcbCapture {
+    PcbTable* table;
+#ifdef ESP32
+    SemaphoreHandle_t done;     // Given once the table is filled, NULL in-thread
+#endif
+};
+
+/**
+ * @brief Copy the active tcp_pcb list into a PcbTable; tcpip thread only
+ */
+void netstatsCapturePcbs(void* arg) {
+    PcbCapture* cap = (PcbCapture*)arg;
+    PcbTable* t = cap->table;
+    t->count = 0;
+    t->taken_ms = millis();
+    for (tcp_pcb* pcb = tcp_active_pcbs; pcb && t->count < NETSTATS_MAX_PCBS; pcb = pcb->next) {
+        if (t->port_a && pcb->local_port != t->port_a && pcb->local_port != t->port_b) continue;
+        PcbSnapshot& s = t->pcbs[t->count++];
+        s.remote_ip = ip_addr_get_ip4_u32(&pcb->remote_ip);
+        s.local_port = pcb->local_port;
+        s.remote_port = pcb->remote_port;
+        s.state = pcb->state;
+        s.nrtx = pcb->nrtx;
+        s.dupacks = pcb->dupacks;
+        s.fast_recovery = pcb->flags & TF_INFR;
+        s.mss = pcb->mss;
+        s.snd_queuelen = pcb->snd_queuelen;
+        s.ooseq = 0;
+#if TCP_QUEUE_OOSEQ
+        for (tcp_seg* seg = pcb->ooseq; seg; seg = seg->next) s.ooseq++;
+#endif
+        s.cwnd = pcb->cwnd;
+        s.ssthresh = pcb->ssthresh;
+        s.snd_wnd = pcb->snd_wnd;
+        s.rcv_wnd = pcb->rcv_wnd;
+        s.snd_buf = pcb->snd_buf;
+        s.srtt_ms = (pcb->sa >> 3) * TCP_SLOW_INTERVAL;
+        s.rto_ms = pcb->rto * TCP_SLOW_INTERVAL;
+    }
+#ifdef ESP32
+    if (cap->done) xSemaphoreGive(cap->done);
+#endif
+}
+
+/**
+ * @brief Snapshot the connections on portA/portB (0: all) into t
+ * @param inTcpip True when already running in the tcpip thread
+ */
+void netstatsSnapshot(PcbTable& t, uint16_t portA, uint16_t portB, bool inTcpip) {
+    t.port_a = portA;
+    t.port_b = portB;
+    PcbCapture cap = { &t };
+#ifdef ESP32
+    cap.done = NULL;
+    if (!inTcpip) {
+        cap.done = xSemaphoreCreateBinary();
+        if (!cap.done) return;
+        if (tcpip_callback(netstatsCapturePcbs, &cap) == ERR_OK) {
+            // The callback always runs; cap must outlive it
+            xSemaphoreTake(cap.done, portMAX_DELAY);
+        }
+        vSemaphoreDelete(cap.done);
+        return;
+    }
+#endif
+    netstatsCapturePcbs(&cap); // In-thread, or single context on ESP8266
+}
+
+// -------------------------------------------------------------------------
+// Per-station Accounting
+// -------------------------------------------------------------------------
+// Every test path credits the bytes it moves to the peer's IP address:
+// HTTP downloads and uploads, the TX engine and the iperf sinks. Entries
+// are resolved to the station MAC from the ARP table, so /api/clients can
+// show who is using the airtime when several clients load the AP at once.
+// The table is fixed at MAX_STATIONS entries; the least recently active
+// entry is reused when a new peer appears.
+//
+// The soft-AP API exposes RSSI and the negotiated PHY mode per station, but
+// not the PHY rate or 802.11 retry counts, so those are not reported.
+
+/**
+ * @brief Traffic credited to one peer
+ */
+struct StationStats {
+    uint32_t ip;            // Network byte order, 0: slot free
+    uint8_t  mac[6];
+    bool     resolved;      // mac is valid
+    uint64_t tx_bytes;      // Payload sent to the peer
+    uint64_t rx_bytes;      // Payload received from the peer
+    uint32_t sessions;      // Test streams started
+    uint32_t last_ms;       // Most recent activity
+};
+StationStats station_stats[MAX_STATIONS];
+const uint32_t STATION_ACTIVE_MS = 2000; // Reported as active within this window
+volatile bool station_resolve_pending = false;
+
+/**
+ * @brief Fill in the MAC of unresolved entries from the ARP table
+ * Runs in the tcpip thread, which owns the ARP table; station_stats still
+ * needs STATS_LOCK against stationAccount() in other tasks.
+ */
+void stationResolveMacs(void* arg) {
+    station_resolve_pending = false;
+    STATS_LOCK();
+    for (int i = 0; i < MAX_STATIONS; i++) {
+        StationStats& s = station_stats[i];
+        if (!s.ip || s.resolved) continue;
+        ip4_addr_t ip;
+        ip4_addr_set_u32(&ip, s.ip);
+        struct eth_addr* mac = NULL;
+        const ip4_addr_t* found = NULL;
+        if (etharp_find_addr(NULL, &ip, &mac, &found) >= 0 && mac) {
+            memcpy(s.mac, mac->addr, 6);
+            s.resolved = true;
+        }
+    }
+    STATS_UNLOCK();
+}
+
+/**
+ * @brief Find or allocate the entry for ip; call under STATS_LOCK
+ */
+StationStats* stationEntry(uint32_t ip) {
+    StationStats* oldest = &station_stats[0];
+    for (int i = 0; i < MAX_STATIONS; i++) {
+        StationStats& s = station_stats[i];
+        if (s.ip == ip) return &s;
+        if (!s.ip) {
+            oldest = &s;
+        } else if (oldest->ip && (int32_t)(s.last_ms - oldest->last_ms) < 0) {
+            oldest = &s;
+        }
+    }
+    *oldest = {};
+    oldest->ip = ip;
+    oldest->last_ms = millis();
+    return oldest;
+}
+
+/**
+ * @brief Credit bytes to a peer; new or unresolved peers queue an ARP lookup
+ * @param session True when this call starts a new test stream
+ */
+void stationAccount(uint32_t ip, size_t tx, size_t rx, bool session = false) {
+    if (!ip) return;
+    uint32_t now = millis();
+    STATS_LOCK();
+    StationStats* s = stationEntry(ip);
+    s->tx_bytes += tx;
+    s->rx_bytes += rx;
+    if (session) s->sessions++;
+    s->last_ms = now;
+    bool resolve = !s->resolved && !station_resolve_pending;
+    if (resolve) station_resolve_pending = true;
+    STATS_UNLOCK();
+
+    if (resolve) {
+#ifdef ESP32
+        if (tcpip_callback(stationResolveMacs, NULL) != ERR_OK) station_resolve_pending = false;
+#else
+        stationResolveMacs(NULL); // Single context on ESP8266
+#endif
+    }
+}
+
+/**
+ * @brief Copy the entry for a station MAC; false if it moved no traffic
+ */
+bool stationLookup(const uint8_t* mac, StationStats& out) {
+    bool found = false;
+    STATS_LOCK();
+    for (int i = 0; i < MAX_STATIONS && !found; i++) {
+        const StationStats& s = station_stats[i];
+        if (s.ip && s.resolved && memcmp(s.mac, mac, 6) == 0) {
+            out = s;
+            found = true;
+        }
+    }
+    STATS_UNLOCK();
+    return found;
+}
+
+// -------------------------------------------------------------------------
+// Sweep Results
+// -------------------------------------------------------------------------
+// The dashboard's sweep runs downloads over a matrix of write sizes and
+// transfer sizes, and uploads over a range of transfer sizes. Each request
+// carries sweep=1. Every finished session tagged that way becomes one cell
+// here, with the rate and retransmits measured on the device, so one table
+// shows the best write size for the chip. Oldest cells are overwritten.
+
+const int SWEEP_MAX_CELLS = 24;    // Sized so /api/sweep fits json_buf
+
+/**
+ * @brief One finished sweep measurement
+ */
+struct SweepCell {
+    char     dir;           // 'D' download, 'U' upload
+    uint8_t  streams;
+    uint32_t chunk;         // Download: bytes per write; upload: mean bytes per read
+    uint32_t size;          // Bytes per stream
+    uint64_t bytes;         // Moved across all streams
+    uint32_t duration_us;
+    uint32_t rexmit;        // TCP retransmits during the cell
+};
+SweepCell sweep_cells[SWEEP_MAX_CELLS];
+uint32_t sweep_count = 0;   // Cells recorded since the last clear
+
+/**
+ * @brief Append one result to the sweep table
+ */
+void sweepRecord(char dir, uint32_t chunk, uint32_t size, uint8_t streams, uint64_t bytes,
+                 int64_t durationUs, uint32_t rexmit) {
+    SweepCell cell = { dir, streams, chunk, size, bytes, (uint32_t)durationUs, rexmit };
+    STATS_LOCK();
+    sweep_cells[sweep_count % SWEEP_MAX_CELLS] = cell;
+    sweep_count++;
+    STATS_UNLOCK();
+}
+
+// -------------------------------------------------------------------------
+// Results Log
+// -------------------------------------------------------------------------
+// Every finished test appends one fixed-size record to /results.bin on
+// LittleFS, so results survive reloads and reboots and a soak test can run
+// for days. Producers only copy the record into a small RAM queue; a writer
+// (a low-priority task on ESP32, loop() on ESP8266) appends queued records
+// in batches, so no network task waits for flash. When the file reaches
+// RESULTS_LOG_MAX_BYTES it becomes /results.old.bin and a new one starts,
+// which bounds flash use at twice that; LittleFS spreads the writes.
+//
+// /api/results/export streams both files as CSV, a few records per chunk.
+// Record fields by type (p1, p2 | v1, v2, v3):
+//   boot      reset reason, free heap      |
+//   download  streams, chunk bytes         | Mbps, MB, retransmits
+//   upload    streams, bytes per read      | Mbps, MB, retransmits
+//   iperf_tcp connections, 0               | Mbps, MB
+//   iperf_udp datagrams, lost              | Mbps, loss %, jitter ms
+//   udp_blast rate kbps, datagram bytes    | receiver Mbps, loss %, jitter ms
+//   latency   probes, received             | avg ms, p99 ms, jitter ms
+//   sta       tests, 0                     | upload Mbps, download Mbps, latency ms
+//   sequence  TX power x100, tests         | download Mbps, upload Mbps, latency ms
+//   duplex    download, upload streams     | download Mbps, upload Mbps, retransmits
+
+enum ResultType : uint8_t {
+    RESULT_BOOT,
+    RESULT_DOWNLOAD,
+    RESULT_UPLOAD,
+    RESULT_IPERF_TCP,
+    RESULT_IPERF_UDP,
+    RESULT_UDP_BLAST,
+    RESULT_LATENCY,
+    RESULT_STA,
+    RESULT_SEQUENCE,
+    RESULT_DUPLEX,
+    RESULT_TYPE_COUNT
+};
+const char* RESULT_TYPE_NAMES[RESULT_TYPE_COUNT] = {
+    "boot", "download", "upload", "iperf_tcp", "iperf_udp", "udp_blast", "latency", "sta", "sequence", "duplex"
+};
+
+/**
+ * @brief One log record, as stored in flash
+ */
+struct ResultRecord {
+    uint32_t seq;           // Record number since the log was created
+    uint16_t boot;          // Boot number since the log was created
+    uint8_t  type;          // ResultType
+    uint8_t  version;       // RESULT_RECORD_VERSION
+    uint32_t uptime_ms;
+    uint32_t param[2];
+    float    value[3];
+};
+static_assert(sizeof(ResultRecord) == 32, "ResultRecord is a fixed 32-byte flash record");
+
+#if FEATURE_RESULTS_LOG
+const uint8_t RESULT_RECORD_VERSION = 1;
+const char* RESULTS_PATH = "/results.bin";
+const char* RESULTS_OLD_PATH = "/results.old.bin";
+const size_t RESULTS_LOG_MAX_BYTES = 64 * 1024;     // 2048 records per file
+const int RESULTS_QUEUE = 16;                       // Records waiting for the writer
+const uint32_t RESULTS_FLUSH_MS = 500;              // Batch window after the first record
+
+/**
+ * @brief Log state; the queue is guarded by STATS_LOCK
+ */
+struct ResultsLog {
+    bool     mounted;
+    uint32_t next_seq;
+    uint16_t boot;
+    uint32_t written;       // Records appended this boot
+    uint32_t dropped;       // Queue full or write failed
+    uint32_t write_errors;
+    uint32_t first_queued_ms;
+    uint8_t  queued;
+    ResultRecord queue[RESULTS_QUEUE];
+};
+ResultsLog results = {};
+
+#ifdef ESP32
+TaskHandle_t results_task = NULL;
+#endif
+
+/**
+ * @brief Queue one result for the log; never touches flash
+ */
+void resultsLog(ResultType type, uint32_t p1, uint32_t p2, float v1 = 0, float v2 = 0, float v3 = 0) {
+    if (!results.mounted) return;
+    bool wake = false;
+    STATS_LOCK();
+    if (results.queued < RESULTS_QUEUE) {
+        ResultRecord& r = results.queue[results.queued];
+        r = {};
+        r.seq = results.next_seq++;
+        r.boot = results.boot;
+        r.type = type;
+        r.version = RESULT_RECORD_VERSION;
+        r.uptime_ms = millis();
+        r.param[0] = p1;
+        r.param[1] = p2;
+        r.value[0] = v1;
+        r.value[1] = v2;
+        r.value[2] = v3;
+        if (results.queued++ == 0) {
+            results.first_queued_ms = r.uptime_ms;
+            wake = true;
+        }
+    } else {
+        results.dropped++;
+    }
+    STATS_UNLOCK();
+#ifdef ESP32
+    if (wake && results_task) xTaskNotifyGive(results_task);
+#else
+    (void)wake;
+#endif
+}
+
+/**
+ * @brief Append every queued record, rotating the file when it is full
+ */
+void resultsFlush() {
+    ResultRecord batch[RESULTS_QUEUE];
+    STATS_LOCK();
+    uint8_t n = results.queued;
+    memcpy(batch, results.queue, n * sizeof(ResultRecord));
+    results.queued = 0;
+    STATS_UNLOCK();
+    if (n == 0) return;
+
+    File f = LittleFS.open(RESULTS_PATH, "a");
+    if (f && f.size() >= RESULTS_LOG_MAX_BYTES) {
+        f.close();
+        LittleFS.remove(RESULTS_OLD_PATH);
+        LittleFS.rename(RESULTS_PATH, RESULTS_OLD_PATH);
+        f = LittleFS.open(RESULTS_PATH, "a");
+    }
+    size_t len = n * sizeof(ResultRecord);
+    bool ok = f && f.write((const uint8_t*)batch, len) == len;
+    if (f) f.close();
+    STATS_LOCK();
+    if (ok) {
+        results.written += n;
+    } else {
+        results.write_errors++;
+        results.dropped += n;
+    }
+    STATS_UNLOCK();
+}
+
+#ifdef ESP32
+/**
+ * @brief Writer task: waits for a record, lets a batch gather, then appends
+ */
+void resultsTask(void* arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(RESULTS_FLUSH_MS));
+        resultsFlush();
+    }
+}
+#endif
+
+/**
+ * @brief Poll the writer from loop() (ESP8266; ESP32 uses a task)
+ */
+void resultsService() {
+#ifndef ESP32
+    if (results.queued && millis() - results.first_queued_ms >= RESULTS_FLUSH_MS) resultsFlush();
+#endif
+}
+
+/**
+ * @brief Read the last record of a log file
+ */
+bool resultsReadLast(const char* path, ResultRecord& out) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    size_t size = f.size() - f.size() % sizeof(ResultRecord);
+    bool ok = size > 0 && f.seek(size - sizeof(ResultRecord)) &&
+              f.read((uint8_t*)&out, sizeof(out)) == sizeof(out);
+    f.close();
+    return ok;
+}
+
+/**
+ * @brief Mount the filesystem, continue the record and boot numbering
+ */
+void startResultsLog() {
+#ifdef ESP32
+    results.mounted = LittleFS.begin(true); // Formats an empty partition
+#else
+    results.mounted = LittleFS.begin();
+#endif
+    if (!results.mounted) {
+        Serial.println("Results log: LittleFS mount failed");
+        return;
+    }
+    ResultRecord last;
+    if (resultsReadLast(RESULTS_PATH, last) || resultsReadLast(RESULTS_OLD_PATH, last)) {
+        results.next_seq = last.seq + 1;
+        results.boot = last.boot + 1;
+    }
+#ifdef ESP32
+    startTask(resultsTask, "results", 3072, tskIDLE_PRIORITY + 1, CONTROL_CORE, &results_task);
+#endif
+    resultsLog(RESULT_BOOT, bootResetReason(), ESP.getFreeHeap());
+    Serial.printf("Results log: boot %u, record %u\n", results.boot, (unsigned)results.next_seq);
+}
+#else
+void resultsLog(ResultType type, uint32_t p1, uint32_t p2, float v1 = 0, float v2 = 0, float v3 = 0) {}
+void resultsService() {}
+void startResultsLog() {}
+#endif
+
+// -------------------------------------------------------------------------
+// Test Session Accounting
+// -------------------------------------------------------------------------
+
+/**
+ * @brief Join (or open) a multi-stream download session
+ * The first stream carrying a new session id, or any stream arriving after
+ * the previous session completed, resets the aggregate counters.
+ */
+void downloadSessionBegin(uint32_t session, long streams, size_t size, size_t chunk, bool sweep) {
+    uint32_t rexmit = tcpRexmitCount();
+    STATS_LOCK();
+    bool fresh = session != dl_session.id || dl_session.finished >= dl_session.streams;
+    if (fresh) {
+        dl_session = {};
+        dl_session.id = session;
+        dl_session.streams = constrain(streams, 1L, (long)MAX_DOWNLOAD_STREAMS);
+        dl_session.size = size;
+        dl_session.chunk = chunk;
+        dl_session.sweep = sweep;
+        dl_session.rexmit_start = rexmit;
+    }
+    STATS_UNLOCK();
+    if (fresh) netstatsMark("download");
+}
+
+/**
+ * @brief Account payload delivered by one stream of a session
+ * @param finished True when this stream has delivered its full payload
+ */
+void downloadSessionAdd(uint32_t session, size_t bytes, bool finished) {
+    uint32_t now = millis();
+    bool complete = false;
+    STATS_LOCK();
+    traffic_tx_bytes += bytes;
+    if (session == dl_session.id) {
+        if (dl_session.bytes == 0 && bytes > 0) dl_session.start_ms = now;
+        dl_session.bytes += bytes;
+        if (finished) {
+            dl_session.finished++;
+            dl_session.end_ms = now;
+            complete = dl_session.finished == dl_session.streams;
+        }
+    }
+    DownloadSession st = dl_session;
+    STATS_UNLOCK();
+    if (complete) {
+        int64_t durationUs = (int64_t)(st.end_ms - st.start_ms) * 1000;
+        uint32_t rexmit = tcpRexmitCount() - st.rexmit_start;
+        if (st.sweep) sweepRecord('D', st.chunk, st.size, st.streams, st.bytes, durationUs, rexmit);
+        resultsLog(RESULT_DOWNLOAD, st.streams, st.chunk, toMbps(st.bytes, durationUs), st.bytes / 1e6f, rexmit);
+    }
+}
+
+/**
+ * @brief Account one body chunk received by the upload sink
+ */
+void uploadSessionAdd(uint32_t session, long streams, size_t bytes) {
+    int64_t now = esp_timer_get_time();
+    STATS_LOCK();
+    bool fresh = session != ul_session.id || ul_session.finished >= ul_session.streams;
+    if (fresh) {
+        ul_session = {};
+        ul_session.id = session;
+        ul_session.streams = constrain(streams, 1L, (long)MAX_DOWNLOAD_STREAMS);
+        ul_session.rexmit_start = tcpRexmitCount();
+    }
+    if (ul_session.chunks == 0) {
+        ul_session.first_us = now;
+        ul_session.first_chunk = bytes;
+    }
+    ul_session.bytes += bytes;
+    traffic_rx_bytes += bytes;
+    ul_session.last_us = now;
+    ul_session.chunks++;
+    STATS_UNLOCK();
+    if (fresh) netstatsMark("upload");
+}
+
+// -------------------------------------------------------------------------
+// Download Payload & Zero-copy TX Engine
+// -------------------------------------------------------------------------
+// Every download path streams the same constant payload buffer, allocated and
+// filled once at boot: 64 KB from PSRAM when the board has it, otherwise a
+// 16 KB aligned static block. Nothing is memset per chunk and no stack buffer
+// is involved.
+//
+// The TX engine is a minimal HTTP responder on TX_ENGINE_PORT built directly
+// on the lwIP raw API. Payload is handed to tcp_write() by reference (no
+// TCP_WRITE_FLAG_COPY), so lwIP builds segments straight from the buffer, and
+// the next write is triggered by the tcp_sent() ACK callback instead of a
+// fixed sleep. It runs inside the tcpip thread and serves several sockets at
+// once regardless of which HTTP backend is compiled in.
+
+const uint16_t TX_ENGINE_PORT = 8081;
+const int TX_ENGINE_MAX_CONNS = MAX_DOWNLOAD_STREAMS;
+const size_t TX_PAYLOAD_STATIC_SIZE = 16 * 1024;
+const size_t TX_PAYLOAD_PSRAM_SIZE = 64 * 1024;
+
+alignas(4) static uint8_t tx_payload_static[TX_PAYLOAD_STATIC_SIZE];
+const uint8_t* tx_payload = tx_payload_static;
+size_t tx_payload_size = TX_PAYLOAD_STATIC_SIZE;
+bool tx_payload_psram = false;
+
+// Runtime tuning, set by the active performance profile
+size_t tx_chunk_size = TX_PAYLOAD_STATIC_SIZE;  // Bytes per write on the download paths
+size_t tx_snd_clamp = 0;                        // TX engine: max unacked bytes, 0 = lwIP limit
+bool tcp_no_delay = true;                       // Disable Nagle on download sockets
+
+/**
+ * @brief Write size for one download: a per-request override or the profile's
+ */
+size_t downloadChunk(size_t requested) {
+    if (requested == 0) return tx_chunk_size;
+    return constrain(requested, (size_t)256, tx_payload_size);
+}
+
+/**
+ * @brief Allocate and fill the shared download payload
+ */
+void initTxPayload() {
+#ifdef ESP32
+    if (ESP.getPsramSize() > 0) {
+        uint8_t* buf = (uint8_t*)heap_caps_aligned_alloc(4, TX_PAYLOAD_PSRAM_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (buf) {
+            memset(buf, 0xAA, TX_PAYLOAD_PSRAM_SIZE);
+            tx_payload = buf;
+            tx_payload_size = TX_PAYLOAD_PSRAM_SIZE;
+            tx_payload_psram = true;
+            tx_chunk_size = tx_payload_size;
+            return;
+        }
+    }
+#endif
+    memset(tx_payload_static, 0xAA, sizeof(tx_payload_static));
+}
+
+#if FEATURE_TRAFFIC_ENGINES
+/**
+ * @brief Per-connection state of the TX engine
+ */
+struct TxConn {
+    bool      used;
+    tcp_pcb*  pcb;
+    char      request[160];  // Start of the request, enough for the request line
+    uint16_t  requestLen;
+    uint16_t  headerUnacked; // Response header bytes not yet acknowledged
+    bool      streaming;     // Headers parsed, body in flight
+    size_t    total;         // Body length requested (SIZE_MAX while timed)
+    size_t    queued;        // Body bytes handed to tcp_write()
+    uint32_t  session;       // DownloadSession tag
+    size_t    chunk;         // Bytes per tcp_write()
+    uint32_t  deadline;      // millis() at which a timed body ends, 0 = sized
+    uint32_t  lastActivity;  // millis() of the last progress
+};
+TxConn tx_conns[TX_ENGINE_MAX_CONNS];
+volatile uint64_t tx_engine_bytes = 0;  // Acknowledged payload since boot
+volatile uint8_t tx_engine_active = 0;  // Connections currently streaming
+
+/**
+ * @brief Release a connection slot and detach it from its pcb
+ * @return ERR_ABRT if the pcb had to be aborted (callbacks must return it)
+ */
+err_t txConnClose(TxConn* c, bool abort) {
+    err_t result = ERR_OK;
+    if (c->pcb) {
+        tcp_arg(c->pcb, NULL);
+        tcp_recv(c->pcb, NULL);
+        tcp_sent(c->pcb, NULL);
+        tcp_err(c->pcb, NULL);
+        tcp_poll(c->pcb, NULL, 0);
+        if (abort || tcp_close(c->pcb) != ERR_OK) {
+            tcp_abort(c->pcb);
+            result = ERR_ABRT;
+        }
+    }
+    if (c->streaming && tx_engine_active > 0) tx_engine_active--;
+    c->used = false;
+    c->pcb = NULL;
+    return result;
+}
+
+/**
+ * @brief Queue as much payload as the send buffer accepts, by reference
+ */
+void txConnPump(TxConn* c) {
+    // A timed body ends with whatever is queued when the deadline passes
+    if (c->deadline && (int32_t)(millis() - c->deadline) >= 0) c->total = c->queued;
+    while (c->queued < c->total) {
+        size_t room = tcp_sndbuf(c->pcb);
+        if (tx_snd_clamp > 0) {
+            // Keep at most tx_snd_clamp bytes unacknowledged
+            size_t inflight = TCP_SND_BUF > room ? TCP_SND_BUF - room : 0;
+            room = inflight < tx_snd_clamp ? tx_snd_clamp - inflight : 0;
+            if (room > tcp_sndbuf(c->pcb)) room = tcp_sndbuf(c->pcb);
+        }
+        if (room == 0 || tcp_sndqueuelen(c->pcb) >= TCP_SND_QUEUELEN) break;
+
+        size_t len = c->total - c->queued;
+        if (len > c->chunk) len = c->chunk;
+        if (len > room) len = room;
+        if (len > 0xFFFF) len = 0xFFFF;
+
+        uint8_t flags = (c->queued + len < c->total) ? TCP_WRITE_FLAG_MORE : 0;
+        if (tcp_write(c->pcb, tx_payload, len, flags) != ERR_OK) break; // Retry on next ACK
+        c->queued += len;
+    }
+    tcp_output(c->pcb);
+}
+
+/**
+ * @brief Parse "GET /download?size=..&streams=..&session=.." and start the body
+ * With duration_ms the body streams until the deadline instead and ends
+ * when the connection closes (no Content-Length).
+ * @return false if lwIP could not queue the response header
+ */
+bool txConnStart(TxConn* c) {
+    size_t size = 1024 * 1024;
+    uint32_t durationMs = 0;
+    long streams = 1;
+    bool sweep = false;
+    c->session = 0;
+    c->chunk = 0;
+
+    bool ok = strncmp(c->request, "GET /download", 13) == 0;
+    if (ok) {
+        const char* q = strchr(c->request, '?');
+        const char* eol = strchr(c->request, '\r');
+        while (q && (!eol || q < eol)) {
+            q++;
+            if (strncmp(q, "size=", 5) == 0) size = strtoul(q + 5, NULL, 10);
+            else if (strncmp(q, "streams=", 8) == 0) streams = strtol(q + 8, NULL, 10);
+            else if (strncmp(q, "session=", 8) == 0) c->session = strtoul(q + 8, NULL, 10);
+            else if (strncmp(q, "chunk=", 6) == 0) c->chunk = strtoul(q + 6, NULL, 10);
+            else if (strncmp(q, "sweep=", 6) == 0) sweep = q[6] == '1';
+            else if (strncmp(q, "duration_ms=", 12) == 0) durationMs = strtoul(q + 12, NULL, 10);
+            q = strchr(q, '&');
+        }
+    }
+    c->chunk = downloadChunk(c->chunk);
+
+    char header[224];
+    int n;
+    if (ok && durationMs > 0) {
+        n = snprintf(header, sizeof(header),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/octet-stream\r\n"
+            "Cache-Control: no-store\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n\r\n");
+        c->deadline = millis() + min(durationMs, MAX_TIMED_TRANSFER_MS);
+        size = SIZE_MAX;
+    } else if (ok) {
+        n = snprintf(header, sizeof(header),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/octet-stream\r\n"
+            "Content-Length: %u\r\n"
+            "Cache-Control: no-store\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n\r\n", (unsigned)size);
+    } else {
+        n = snprintf(header, sizeof(header),
+            "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        size = 0;
+    }
+    // Header is on the stack; without it the body would be a malformed
+    // response, so the caller aborts instead
+    if (tcp_write(c->pcb, header, n, TCP_WRITE_FLAG_COPY) != ERR_OK) return false;
+    c->headerUnacked = n;
+
+    c->total = size;
+    c->queued = 0;
+    c->streaming = true;
+    tx_engine_active++;
+    if (ok) {
+        downloadSessionBegin(c->session, streams, c->deadline ? 0 : size, c->chunk, sweep);
+        stationAccount(ip_addr_get_ip4_u32(&c->pcb->remote_ip), 0, 0, true);
+    }
+    txConnPump(c);
+    return true;
+}
+
+err_t txConnSent(void* arg, tcp_pcb* pcb, u16_t len) {
+    TxConn* c = (TxConn*)arg;
+    c->lastActivity = millis();
+
+    // Header bytes are acknowledged first; only count the body
+    size_t acked = len;
+    size_t header = acked < c->headerUnacked ? acked : c->headerUnacked;
+    c->headerUnacked -= header;
+    acked -= header;
+    if (acked > 0) {
+        tx_engine_bytes += acked;
+        downloadSessionAdd(c->session, acked, false);
+        stationAccount(ip_addr_get_ip4_u32(&pcb->remote_ip), acked, 0);
+    }
+
+    if (c->queued < c->total) txConnPump(c);
+    if (c->queued >= c->total && pcb->unacked == NULL && pcb->unsent == NULL) {
+        // Everything acknowledged: the stream is complete
+        if (c->total > 0) {
+            netstatsSnapshot(pcb_download, TX_ENGINE_PORT, WEB_PORT, true);
+            downloadSessionAdd(c->session, 0, true);
+        }
+        return txConnClose(c, false);
+    }
+    return ERR_OK;
+}
+
+err_t txConnRecv(void* arg, tcp_pcb* pcb, pbuf* p, err_t err) {
+    TxConn* c = (TxConn*)arg;
+    if (p == NULL) {
+        // Peer closed its side; finish if nothing is left to send
+        if (!c->streaming || c->queued >= c->total) return txConnClose(c, false);
+        return ERR_OK;
+    }
+    if (!c->streaming) {
+        size_t room = sizeof(c->request) - 1 - c->requestLen;
+        size_t n = p->tot_len < room ? p->tot_len : room;
+        pbuf_copy_partial(p, c->request + c->requestLen, n, 0);
+        c->requestLen += n;
+        c->request[c->requestLen] = '\0';
+
+        // Start once the request line is complete; remaining headers are
+        // irrelevant and simply consumed.
+        if ((strstr(c->request, "\r\n") || c->requestLen >= sizeof(c->request) - 1) && !txConnStart(c)) {
+            // Out of send segments (typically an accept burst)
+            pbuf_free(p);
+            return txConnClose(c, true);
+        }
+    }
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+void txConnError(void* arg, err_t err) {
+    TxConn* c = (TxConn*)arg;
+    if (!c) return;
+    c->pcb = NULL; // Already freed by lwIP
+    txConnClose(c, false);
+}
+
+err_t txConnPoll(void* arg, tcp_pcb* pcb) {
+    TxConn* c = (TxConn*)arg;
+    if (millis() - c->lastActivity > 10000) {
+        return txConnClose(c, true); // Stalled peer
+    }
+    return ERR_OK;
+}
+
+err_t txEngineAccept(void* arg, tcp_pcb* pcb, err_t err) {
+    if (err != ERR_OK || pcb == NULL) return ERR_VAL;
+
+    TxConn* c = NULL;
+    for (int i = 0; i < TX_ENGINE_MAX_CONNS; i++) {
+        if (!tx_conns[i].used) { c = &tx_conns[i]; break; }
+    }
+    if (!c) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+
+    memset(c, 0, sizeof(*c));
+    c->used = true;
+    c->pcb = pcb;
+    c->lastActivity = millis();
+    if (tcp_no_delay) tcp_nagle_disable(pcb);
+    tcp_arg(pcb, c);
+    tcp_recv(pcb, txConnRecv);
+    tcp_sent(pcb, txConnSent);
+    tcp_err(pcb, txConnError);
+    tcp_poll(pcb, txConnPoll, 4); // Every 2 s
+    return ERR_OK;
+}
+
+/**
+ * @brief Create the listening pcb; must run in the tcpip thread
+ */
+void txEngineListen(void* arg) {
+    tcp_pcb* pcb = tcp_new();
+    if (!pcb || tcp_bind(pcb, IP_ADDR_ANY, TX_ENGINE_PORT) != ERR_OK) {
+        Serial.println("TX engine: bind failed");
+        return;
+    }
+    pcb = tcp_listen_with_backlog(pcb, TX_ENGINE_MAX_CONNS);
+    tcp_accept(pcb, txEngineAccept);
+}
+
+#endif
+
+/**
+ * @brief Start the zero-copy download engine on TX_ENGINE_PORT
+ */
+void startTxEngine() {
+#if FEATURE_TRAFFIC_ENGINES
+#ifdef ESP32
+    tcpip_callback(txEngineListen, NULL);
+#else
+    txEngineListen(NULL); // Single context on ESP8266
+#endif
+    Serial.printf("TX engine listening on %u (%u KB payload%s)\n",
+                  TX_ENGINE_PORT, (unsigned)(tx_payload_size / 1024), tx_payload_psram ? ", PSRAM" : "");
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Captive-portal DNS
+// -------------------------------------------------------------------------
+// Answers every A query with the AP address, straight from the lwIP receive
+// callback (tcpip thread on ESP32, the SDK's network context on ESP8266).
+// Nothing waits for loop() or the HTTP task, so phone connectivity checks
+// are answered while a download or iperf run saturates the link, and the
+// phone keeps the AP instead of dropping it as "no internet".
+//
+// The reply is the query header and question echoed back plus a fixed
+// 16-byte answer record built once at start. AAAA and other types get an
+// empty NOERROR reply, so clients fall back to IPv4 straight away. Queries
+// are never parsed beyond the question.
+
+const uint16_t DNS_PORT = 53;
+const int DNS_MAX_QUERY = 512;           // Plain DNS over UDP, no EDNS
+const int DNS_HEADER_LEN = 12;
+const uint32_t DNS_TTL_S = 60;
+
+/**
+ * @brief Counters for /api/dns; written only by the receive callback
+ */
+struct DnsStats {
+    uint32_t queries;       // Datagrams received on DNS_PORT
+    uint32_t answered;      // A/ANY replies with the AP address
+    uint32_t empty;         // NOERROR replies without an answer (AAAA etc.)
+    uint32_t malformed;     // Dropped: not a standard single-question query
+    uint32_t no_mem;        // Dropped: reply pbuf allocation failed
+    uint32_t send_errors;   // Dropped: udp_sendto() failed
+    uint64_t latency_total_us;
+    uint32_t latency_max_us;
+    uint32_t last_ms;       // millis() of the last query
+};
+volatile DnsStats dns_stats = {};
+
+uint8_t dns_answer[16];                 // Precomputed answer record
+uint8_t dns_query[DNS_MAX_QUERY];       // Callback scratch; keeps the tcpip stack small
+udp_pcb* dns_pcb = NULL;
+
+/**
+ * @brief Length of the question section at DNS_HEADER_LEN, 0 if malformed
+ * Allows uncompressed names only, as in any query.
+ */
+int dnsQuestionLength(const uint8_t* msg, int len) {
+    int pos = DNS_HEADER_LEN;
+    while (pos < len && msg[pos] != 0) {
+        uint8_t label = msg[pos];
+        if (label > 63) return 0;
+        pos += label + 1;
+    }
+    pos += 1 + 4; // Root label, QTYPE, QCLASS
+    if (pos > len || pos - DNS_HEADER_LEN > 255 + 5) return 0;
+    return pos - DNS_HEADER_LEN;
+}
+
+/**
+ * @brief Reply to one query from the template
+ */
+void dnsRecv(void* arg, udp_pcb* pcb, pbuf* p, const ip_addr_t* addr, u16_t port) {
+    int64_t start = esp_timer_get_time();
+    volatile DnsStats& st = dns_stats;
+    st.queries++;
+    st.last_ms = millis();
+
+    uint8_t* msg = dns_query;
+    int len = pbuf_copy_partial(p, msg, min((int)p->tot_len, DNS_MAX_QUERY), 0);
+    pbuf_free(p);
+
+    // Standard query (QR=0, OPCODE=0) with exactly one question
+    int qlen = 0;
+    if (len > DNS_HEADER_LEN && (msg[2] & 0xF8) == 0 && msg[4] == 0 && msg[5] == 1) {
+        qlen = dnsQuestionLength(msg, len);
+    }
+    if (qlen == 0) {
+        st.malformed++;
+        return;
+    }
+    int qend = DNS_HEADER_LEN + qlen;
+    uint16_t qtype = (msg[qend - 4] << 8) | msg[qend - 3];
+    bool answer = qtype == 1 || qtype == 255; // A, ANY
+
+    int replyLen = qend + (answer ? sizeof(dns_answer) : 0);
+    pbuf* reply = pbuf_alloc(PBUF_TRANSPORT, replyLen, PBUF_RAM);
+    if (!reply) {
+        st.no_mem++;
+        return;
+    }
+    uint8_t* out = (uint8_t*)reply->payload;
+    memcpy(out, msg, qend);
+    out[2] = 0x84 | (msg[2] & 0x01);    // QR, AA, keep RD
+    out[3] = 0x80;                      // RA, NOERROR
+    out[6] = 0; out[7] = answer ? 1 : 0;
+    out[8] = out[9] = out[10] = out[11] = 0; // Drop NS/AR (EDNS OPT)
+    if (answer) memcpy(out + qend, dns_answer, sizeof(dns_answer));
+
+    err_t err = udp_sendto(pcb, reply, addr, port);
+    pbuf_free(reply);
+    if (err != ERR_OK) {
+        st.send_errors++;
+        return;
+    }
+    if (answer) st.answered++;
+    else st.empty++;
+    uint32_t us = esp_timer_get_time() - start;
+    st.latency_total_us += us;
+    if (us > st.latency_max_us) st.latency_max_us = us;
+}
+
+/**
+ * @brief Bind the DNS pcb; must run in the tcpip thread
+ */
+void dnsListen(void* arg) {
+    dns_pcb = udp_new();
+    if (!dns_pcb || udp_bind(dns_pcb, IP_ADDR_ANY, DNS_PORT) != ERR_OK) {
+        Serial.println("DNS: bind failed");
+        return;
+    }
+    udp_recv(dns_pcb, dnsRecv, NULL);
+}
+
+/**
+ * @brief Answer all DNS names with ip (the soft-AP address)
+ */
+void startCaptiveDns(IPAddress ip) {
+    // Name pointer to the question (0xC00C), type A, class IN, TTL, RDATA
+    const uint8_t head[] = { 0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+                             (uint8_t)(DNS_TTL_S >> 24), (uint8_t)(DNS_TTL_S >> 16),
+                             (uint8_t)(DNS_TTL_S >> 8), (uint8_t)DNS_TTL_S, 0x00, 0x04 };
+    memcpy(dns_answer, head, sizeof(head));
+    for (int i = 0; i < 4; i++) dns_answer[sizeof(head) + i] = ip[i];
+#ifdef ESP32
+    tcpip_callback(dnsListen, NULL);
+#else
+    dnsListen(NULL); // Single context on ESP8266
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Performance Profiles
+// -------------------------------------------------------------------------
+// A profile bundles the radio and TCP settings that can change at runtime,
+// so configurations can be A/B tested on the same board without
+// reflashing. Built-in presets are always available. Up to
+// PROFILE_SLOTS custom profiles and the active profile name are kept in NVS.
+// ESP8266 builds apply profiles for the current boot only.
+//
+// Not runtime-tunable: the lwIP TCP_SND_BUF/TCP_WND ceilings, the tcpip and
+// socket mailbox sizes, and the AMPDU/BA window configuration. They are fixed
+// in the SDK's sdkconfig, and /api/profile reports the compiled values.
+// snd_buf_clamp can only lower the send window (TX engine only).
+
+const uint8_t PROTO_B  = 0x01;  // Same bits as WIFI_PROTOCOL_11B/11G/11N/LR
+const uint8_t PROTO_G  = 0x02;
+const uint8_t PROTO_N  = 0x04;
+const uint8_t PROTO_LR = 0x08;  // Espressif long range, ESP-to-ESP only
+
+/**
+ * @brief Runtime-tunable settings applied as one unit
+ */
+struct PerfProfile {
+    char     name[16];
+    uint8_t  bandwidth;     // 20 or 40 MHz (40 needs 802.11n)
+    uint8_t  protocol;      // PROTO_* mask
+    bool     power_save;    // Modem sleep between beacons
+    bool     no_delay;      // Disable Nagle on download sockets
+    uint16_t chunk_size;    // Bytes per write on the download paths, 0 = payload size
+    uint16_t snd_buf_clamp; // TX engine: max unacknowledged bytes, 0 = lwIP limit
+};
+
+const PerfProfile BUILTIN_PROFILES[] = {
+    { "default",    20, PROTO_B | PROTO_G | PROTO_N, false, true,  0,    0 },
+    { "throughput", 40, PROTO_B | PROTO_G | PROTO_N, false, false, 0,    0 },
+    { "latency",    20, PROTO_B | PROTO_G | PROTO_N, false, true,  1436, 2 * 1436 },
+    { "legacy_bg",  20, PROTO_B | PROTO_G,           false, true,  4096, 0 },
+    { "power_save", 20, PROTO_B | PROTO_G | PROTO_N, true,  true,  0,    0 },
+};
+const int BUILTIN_PROFILE_COUNT = sizeof(BUILTIN_PROFILES) / sizeof(BUILTIN_PROFILES[0]);
+const int PROFILE_SLOTS = 4;
+
+PerfProfile custom_profiles[PROFILE_SLOTS] = {};  // name[0] == 0: slot free
+PerfProfile active_profile = BUILTIN_PROFILES[0];
+
+#ifdef ESP32
+Preferences profile_prefs;
+#endif
+
+/**
+ * @brief Apply a profile to the radio and the download paths
+ */
+void applyProfile(const PerfProfile& p) {
+    active_profile = p;
+    tx_chunk_size = p.chunk_size > 0 ? constrain((size_t)p.chunk_size, (size_t)256, tx_payload_size) : tx_payload_size;
+    tx_snd_clamp = p.snd_buf_clamp;
+    tcp_no_delay = p.no_delay;
+#ifdef ESP32
+    uint8_t proto = p.protocol & (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR);
+    esp_wifi_set_protocol(WIFI_IF_AP, proto ? proto : WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N);
+    bool ht40 = p.bandwidth == 40 && (p.protocol & PROTO_N);
+    esp_wifi_set_bandwidth(WIFI_IF_AP, ht40 ? WIFI_BW_HT40 : WIFI_BW_HT20);
+    WiFi.setSleep(p.power_save);
+#else
+    // ESP8266: one PHY mode for the whole chip, HT20 only
+    wifi_set_phy_mode(p.protocol & PROTO_N ? PHY_MODE_11N : p.protocol & PROTO_G ? PHY_MODE_11G : PHY_MODE_11B);
+    WiFi.setSleepMode(p.power_save ? WIFI_MODEM_SLEEP : WIFI_NONE_SLEEP);
+#endif
+    Serial.printf("Profile '%s': HT%u, proto 0x%02x, chunk %u, clamp %u\n", p.name,
+                  p.bandwidth, p.protocol, (unsigned)tx_chunk_size, (unsigned)tx_snd_clamp);
+}
+
+/**
+ * @brief Look up a built-in or saved profile by name
+ */
+const PerfProfile* findProfile(const char* name) {
+    for (int i = 0; i < BUILTIN_PROFILE_COUNT; i++) {
+        if (strcmp(BUILTIN_PROFILES[i].name, name) == 0) return &BUILTIN_PROFILES[i];
+    }
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        if (custom_profiles[i].name[0] && strcmp(custom_profiles[i].name, name) == 0) return &custom_profiles[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Write one custom slot (or its removal) to NVS
+ */
+void storeProfileSlot(int slot) {
+#ifdef ESP32
+    char key[8];
+    snprintf(key, sizeof(key), "slot%d", slot);
+    if (custom_profiles[slot].name[0]) {
+        profile_prefs.putBytes(key, &custom_profiles[slot], sizeof(PerfProfile));
+    } else {
+        profile_prefs.remove(key);
+    }
+#endif
+}
+
+/**
+ * @brief Remember the active profile across reboots
+ */
+void storeActiveProfile() {
+#ifdef ESP32
+    profile_prefs.putString("active", active_profile.name);
+#endif
+}
+
+/**
+ * @brief Load saved profiles and apply the last active one
+ */
+void startProfiles() {
+    const PerfProfile* p = &BUILTIN_PROFILES[0];
+#ifdef ESP32
+    profile_prefs.begin("perf");
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "slot%d", i);
+        if (profile_prefs.getBytesLength(key) == sizeof(PerfProfile)) {
+            profile_prefs.getBytes(key, &custom_profiles[i], sizeof(PerfProfile));
+            custom_profiles[i].name[sizeof(custom_profiles[i].name) - 1] = '\0';
+        }
+    }
+    String name = profile_prefs.getString("active", "default");
+    const PerfProfile* saved = findProfile(name.c_str());
+    if (saved) p = saved;
+#endif
+    applyProfile(*p);
+}
+
+/**
+ * @brief Parse a protocol string such as "bgn" or "bgnlr" into PROTO_* bits
+ */
+uint8_t parseProtocol(const String& s) {
+    uint8_t mask = 0;
+    if (s.indexOf('b') >= 0) mask |= PROTO_B;
+    if (s.indexOf('g') >= 0) mask |= PROTO_G;
+    if (s.indexOf('n') >= 0) mask |= PROTO_N;
+    if (s.indexOf("lr") >= 0) mask |= PROTO_LR;
+    return mask;
+}
+
+/**
+ * @brief Format PROTO_* bits as "bgn", "bgnlr", ...
+ */
+void formatProtocol(char out[8], uint8_t mask) {
+    char* o = out;
+    if (mask & PROTO_B) *o++ = 'b';
+    if (mask & PROTO_G) *o++ = 'g';
+    if (mask & PROTO_N) *o++ = 'n';
+    if (mask & PROTO_LR) { *o++ = 'l'; *o++ = 'r'; }
+    *o = '\0';
+}
+
+// -------------------------------------------------------------------------
+// HTTP Backend Abstraction
+// -------------------------------------------------------------------------
+// Handlers are written once against HttpRequest. The default backend is the
+// polled WebServer serviced from loop(); building with -DHTTP_ASYNC_BACKEND
+// (see the *_async envs in platformio.ini) switches to ESPAsyncWebServer,
+// where requests are dispatched from the AsyncTCP task and several sockets
+// are served concurrently. Handlers must therefore never block: bulk bodies
+// go through sendPayload(), which the async backend pulls from on demand.
+
+#ifdef HTTP_ASYNC_BACKEND
+typedef WebRequestMethodComposite HttpMethod;
+#else
+typedef HTTPMethod HttpMethod;
+#endif
+
+/**
+ * @brief Notified as payload bytes leave a streamed response
+ * @param bytes Bytes handed to the network in this step
+ * @param done  True once the full body has been produced
+ */
+typedef std::function<void(size_t bytes, bool done)> PayloadObserver;
+
+/**
+ * @brief Produces the next piece of a generated response body
+ * Writes at most maxLen bytes (never less than HTTP_CHUNK_MIN when more
+ * data follows) and returns how many; 0 ends the body.
+ */
+typedef std::function<size_t(uint8_t* buf, size_t maxLen)> ChunkFiller;
+const size_t HTTP_CHUNK_MIN = 128;
+
+// Every route registered through addRoute() is timed from dispatch to the
+// handler's return, and every body byte it sends is counted (streamed bodies
+// as they leave). Latencies go into fixed buckets from which /api/metrics
+// derives the p99. Handlers run in one context per backend (the HTTP task or
+// loop(), or the AsyncTCP task), so the counters are updated without a lock.
+
+const int ROUTE_METRICS_MAX = 32;
+const int ROUTE_LATENCY_BUCKETS = 12;
+const uint32_t ROUTE_BUCKET_US[ROUTE_LATENCY_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
+
+/**
+ * @brief Call count, latency histogram and response bytes for one route
+ */
+struct RouteMetrics {
+    const char* uri;
+    HttpMethod  method;
+    uint32_t    calls;
+    uint64_t    bytes;          // Response body bytes
+    uint64_t    total_us;
+    uint32_t    min_us;
+    uint32_t    max_us;
+    uint32_t    buckets[ROUTE_LATENCY_BUCKETS + 1]; // Last one: above the top bound
+};
+RouteMetrics route_metrics[ROUTE_METRICS_MAX];
+int route_metric_count = 0;
+
+/**
+ * @brief Add one handler run to a route's histogram
+ */
+void routeRecord(RouteMetrics* m, uint32_t us) {
+    if (m->calls == 0 || us < m->min_us) m->min_us = us;
+    if (us > m->max_us) m->max_us = us;
+    m->calls++;
+    m->total_us += us;
+    int b = 0;
+    while (b < ROUTE_LATENCY_BUCKETS && us > ROUTE_BUCKET_US[b]) b++;
+    m->buckets[b]++;
+}
+
+/**
+ * @brief Upper bound of the bucket holding the 99th percentile, in us
+ * Calls above the top bound report max_us.
+ */
+uint32_t routeP99(const RouteMetrics& m) {
+    if (m.calls == 0) return 0;
+    uint32_t rank = m.calls - m.calls / 100; // Calls at or below p99
+    uint32_t seen = 0;
+    for (int b = 0; b < ROUTE_LATENCY_BUCKETS; b++) {
+        seen += m.buckets[b];
+        if (seen >= rank) return min(ROUTE_BUCKET_US[b], m.max_us);
+    }
+    return m.max_us;
+}
+
+/**
+ * @brief Backend-neutral view of the request currently being handled
+ */
+class HttpRequest {
+public:
+#ifdef HTTP_ASYNC_BACKEND
+    explicit HttpRequest(AsyncWebServerRequest* req, RouteMetrics* metrics = nullptr)
+        : _metrics(metrics), _req(req) {}
+#else
+    explicit HttpRequest(RouteMetrics* metrics = nullptr) : _metrics(metrics) {}
+#endif
+
+    bool hasArg(const char* name) {
+#ifdef HTTP_ASYNC_BACKEND
+        return _req->hasArg(name);
+#else
+        return server.hasArg(name);
+#endif
+    }
+
+    String arg(const char* name) {
+#ifdef HTTP_ASYNC_BACKEND
+        return _req->arg(name);
+#else
+        return server.arg(name);
+#endif
+    }
+
+    /**
+     * @brief Integer query parameter with a default when absent
+     */
+    long argInt(const char* name, long fallback) {
+        return hasArg(name) ? arg(name).toInt() : fallback;
+    }
+
+    String host() {
+#ifdef HTTP_ASYNC_BACKEND
+        return _req->host();
+#else
+        return server.hostHeader();
+#endif
+    }
+
+    /**
+     * @brief Peer IPv4 address in network byte order
+     */
+    uint32_t remoteIp() {
+#ifdef HTTP_ASYNC_BACKEND
+        return (uint32_t)_req->client()->remoteIP();
+#else
+        return (uint32_t)server.client().remoteIP();
+#endif
+    }
+
+    /**
+     * @brief Request header value ("" if absent)
+     * The sync backend only keeps headers listed in HTTP_COLLECT_HEADERS.
+     */
+    String header(const char* name) {
+#ifdef HTTP_ASYNC_BACKEND
+        return _req->hasHeader(name) ? _req->header(name) : String();
+#else
+        return server.header(name);
+#endif
+    }
+
+    /**
+     * @brief Queue a response header; must be called before send()
+     */
+    void addHeader(const char* name, const String& value) {
+#ifdef HTTP_ASYNC_BACKEND
+        if (_headerCount < MAX_HEADERS) {
+            _headerNames[_headerCount] = name;
+            _headerValues[_headerCount] = value;
+            _headerCount++;
+        }
+#else
+        server.sendHeader(name, value);
+#endif
+    }
+
+    void send(int code, const char* type, const String& body) {
+        account(body.length());
+#ifdef HTTP_ASYNC_BACKEND
+        finish(_req->beginResponse(code, type, body));
+#else
+        server.send(code, type, body);
+#endif
+    }
+
+    /**
+     * @brief Send a body from a caller-owned buffer
+     */
+    void send(int code, const char* type, const char* body, size_t len) {
+        account(len);
+#ifdef HTTP_ASYNC_BACKEND
+        // The response outlives this call, so it takes its own copy
+        finish(_req->beginResponse(code, type, String(body)));
+#else
+        server.send_P(code, type, body, len);
+#endif
+    }
+
+    /**
+     * @brief Send a constant (flash-resident) body without copying it
+     */
+    void sendProgmem(int code, const char* type, const uint8_t* body, size_t len) {
+        account(len);
+#ifdef HTTP_ASYNC_BACKEND
+        finish(_req->beginResponse_P(code, type, body, len));
+#else
+        server.send_P(code, type, (PGM_P)body, len);
+#endif
+    }
+
+    /**
+     * @brief Send a finished JsonWriter document (500 if it did not fit)
+     */
+    void sendJson(const JsonWriter& w) {
+        if (w.overflowed()) {
+            send(500, "text/plain", "JSON buffer overflow");
+            return;
+        }
+        send(200, "application/json", w.c_str(), w.length());
+    }
+
+    /**
+     * @brief Stream length bytes of the shared download payload
+     * @param chunk Bytes per write, see downloadChunk()
+     * @param durationMs When set, stream for this long instead (chunked
+     *        encoding, length is ignored)
+     */
+    void sendPayload(const char* type, size_t length, size_t chunk, PayloadObserver observer, uint32_t durationMs = 0) {
+        if (durationMs > 0) {
+            sendTimedPayload(type, chunk, observer, durationMs);
+            return;
+        }
+#ifdef HTTP_ASYNC_BACKEND
+        // AsyncTCP calls the filler whenever the socket has room, so the
+        // handler returns immediately and other requests keep flowing. The
+        // library owns the send buffer, so the payload is copied once here.
+        RouteMetrics* metrics = _metrics;
+        finish(_req->beginResponse(type, length, [length, chunk, observer, metrics](uint8_t* buf, size_t maxLen, size_t index) -> size_t {
+            if (maxLen > chunk) maxLen = chunk;
+            size_t n = (length - index) > maxLen ? maxLen : (length - index);
+            for (size_t off = 0; off < n; off += tx_payload_size) {
+                memcpy(buf + off, tx_payload, (n - off) > tx_payload_size ? tx_payload_size : (n - off));
+            }
+            if (metrics) metrics->bytes += n;
+            observer(n, index + n >= length);
+            return n;
+        }));
+#else
+        server.setContentLength(length);
+        server.send(200, type, "");
+
+        size_t sent = 0;
+        WiFiClient client = server.client();
+        client.setNoDelay(tcp_no_delay); // Nagle off by default for lower latency
+
+#ifdef ESP32
+        // Non-blocking sends straight from the payload buffer; when the
+        // socket is full, sleep in select() until lwIP frees send buffer
+        // space instead of burning a full RTOS tick in delay(1).
+        int fd = client.fd();
+        while (sent < length) {
+            size_t len = (length - sent) > chunk ? chunk : (length - sent);
+            int n = ::send(fd, tx_payload, len, MSG_DONTWAIT);
+            if (n > 0) {
+                sent += n;
+                account(n);
+                observer(n, sent >= length);
+                continue;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) break; // Peer gone
+
+            fd_set writeSet;
+            FD_ZERO(&writeSet);
+            FD_SET(fd, &writeSet);
+            timeval tv = {5, 0};
+            if (select(fd + 1, NULL, &writeSet, NULL, &tv) <= 0) break; // Stalled
+        }
+#else
+        while (sent < length && client.connected()) {
+            size_t len = (length - sent) > chunk ? chunk : (length - sent);
+            size_t written = client.write(tx_payload, len);
+            if (written > 0) {
+                sent += written;
+                account(written);
+                observer(written, sent >= length);
+            } else {
+                yield(); // Let the SDK drain the send buffer
+            }
+        }
+#endif
+#endif
+    }
+
+    /**
+     * @brief Stream the download payload until durationMs has passed
+     * The body is chunked, so neither side has to know its length up front.
+     */
+    void sendTimedPayload(const char* type, size_t chunk, PayloadObserver observer, uint32_t durationMs) {
+#ifdef HTTP_ASYNC_BACKEND
+        RouteMetrics* metrics = _metrics;
+        uint32_t start = millis();
+        bool ended = false;
+        finish(_req->beginChunkedResponse(type, [=](uint8_t* buf, size_t maxLen, size_t index) mutable -> size_t {
+            if (ended) return 0;
+            if (millis() - start >= durationMs) {
+                ended = true;
+                observer(0, true);
+                return 0;
+            }
+            size_t n = maxLen > chunk ? chunk : maxLen;
+            memcpy(buf, tx_payload, n);
+            if (metrics) metrics->bytes += n;
+            observer(n, false);
+            return n;
+        }));
+#else
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(200, type, "");
+        WiFiClient client = server.client();
+        client.setNoDelay(tcp_no_delay);
+
+        // One chunk per write, straight from the payload buffer
+        uint32_t start = millis();
+        while (millis() - start < durationMs && client.connected()) {
+            server.sendContent((const char*)tx_payload, chunk);
+            account(chunk);
+            observer(chunk, false);
+        }
+        if (client.connected()) {
+            server.sendContent("");
+            observer(0, true);
+        }
+#endif
+    }
+
+    /**
+     * @brief Stream a generated body of unknown length (chunked encoding)
+     */
+    void sendChunks(const char* type, ChunkFiller filler) {
+#ifdef HTTP_ASYNC_BACKEND
+        RouteMetrics* metrics = _metrics;
+        finish(_req->beginChunkedResponse(type, [filler, metrics](uint8_t* buf, size_t maxLen, size_t index) -> size_t {
+            // Fillers emit whole records; ask again once the window grows
+            if (maxLen < HTTP_CHUNK_MIN) return RESPONSE_TRY_AGAIN;
+            size_t n = filler(buf, maxLen);
+            if (metrics) metrics->bytes += n;
+            return n;
+        }));
+#else
+        static uint8_t chunk[1024];
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(200, type, "");
+        size_t n;
+        while ((n = filler(chunk, sizeof(chunk))) > 0) {
+            server.sendContent((const char*)chunk, n);
+            account(n);
+        }
+        server.sendContent("");
+#endif
+    }
+
+private:
+    /**
+     * @brief Credit body bytes to the route being served
+     */
+    void account(size_t len) {
+        if (_metrics) _metrics->bytes += len;
+    }
+
+    RouteMetrics* _metrics;
+
+#ifdef HTTP_ASYNC_BACKEND
+    static const int MAX_HEADERS = 4;
+
+    void finish(AsyncWebServerResponse* res) {
+        for (int i = 0; i < _headerCount; i++) {
+            res->addHeader(_headerNames[i], _headerValues[i]);
+        }
+        _req->send(res);
+    }
+
+    AsyncWebServerRequest* _req;
+    const char* _headerNames[MAX_HEADERS];
+    String _headerValues[MAX_HEADERS];
+    int _headerCount = 0;
+#endif
+};
+
+typedef void (*HttpHandler)(HttpRequest& req);
+
+/**
+ * @brief Receives request body data as it arrives
+ * @param data  Chunk payload
+ * @param len   Chunk length
+ * @param index Offset of this chunk within the body
+ * @param total Declared body length (0 when unknown)
+ */
+typedef void (*HttpBodyHandler)(HttpRequest& req, const uint8_t* data, size_t len, size_t index, size_t total);
+
+/**
+ * @brief How the sync backend should hand a request body to the sink
+ */
+enum HttpBodyKind {
+    BODY_MULTIPART,  // multipart/form-data file parts (server.upload())
+    BODY_RAW         // Any other content type, unparsed (server.raw())
+};
+
+/**
+ * @brief Allocate the metrics entry for a route; NULL once the table is full
+ */
+RouteMetrics* routeMetricsAdd(const char* uri, HttpMethod method) {
+    if (route_metric_count >= ROUTE_METRICS_MAX) return NULL;
+    RouteMetrics* m = &route_metrics[route_metric_count++];
+    *m = {};
+    m->uri = uri;
+    m->method = method;
+    return m;
+}
+
+/**
+ * @brief Run a handler and record how long it took
+ */
+void runTimed(HttpHandler handler, HttpRequest& req, RouteMetrics* metrics) {
+    int64_t start = esp_timer_get_time();
+    handler(req);
+    if (metrics) routeRecord(metrics, esp_timer_get_time() - start);
+}
+
+#ifdef HTTP_ASYNC_BACKEND
+/**
+ * @brief Async route that matches its URI exactly
+ *
+ * AsyncCallbackWebHandler also accepts any URL under "<uri>/", and the first
+ * registered handler wins, so "/api/download" would swallow
+ * "/api/download/session". The sync WebServer already matches exactly.
+ */
+class ExactRouteHandler : public AsyncWebHandler {
+public:
+    ExactRouteHandler(const char* uri, HttpMethod method, ArRequestHandlerFunction onRequest,
+                      ArUploadHandlerFunction onUpload, ArBodyHandlerFunction onBody)
+        : _uri(uri), _method(method), _onRequest(onRequest), _onUpload(onUpload), _onBody(onBody) {}
+
+    bool canHandle(AsyncWebServerRequest* r) override {
+        if (!(_method & r->method()) || r->url() != _uri) return false;
+        // Keep every header, as AsyncCallbackWebHandler does
+        r->addInterestingHeader("ANY");
+        return true;
+    }
+
+    void handleRequest(AsyncWebServerRequest* r) override { _onRequest(r); }
+
+    void handleUpload(AsyncWebServerRequest* r, const String& filename, size_t index, uint8_t* data, size_t len, bool final) override {
+        if (_onUpload) _onUpload(r, filename, index, data, len, final);
+    }
+
+    void handleBody(AsyncWebServerRequest* r, uint8_t* data, size_t len, size_t index, size_t total) override {
+        if (_onBody) _onBody(r, data, len, index, total);
+    }
+
+    bool isRequestHandlerTrivial() override { return false; }
+
+private:
+    const char* _uri;
+    HttpMethod _method;
+    ArRequestHandlerFunction _onRequest;
+    ArUploadHandlerFunction _onUpload;
+    ArBodyHandlerFunction _onBody;
+};
+#endif
+
+/**
+ * @brief Register a route on whichever backend is compiled in
+ * @param body Optional sink for upload data, invoked before handler
+ * @param kind Body encoding the sink expects (async feeds both the same way)
+ */
+void addRoute(const char* uri, HttpMethod method, HttpHandler handler, HttpBodyHandler body = nullptr, HttpBodyKind kind = BODY_MULTIPART) {
+    RouteMetrics* metrics = routeMetricsAdd(uri, method);
+#ifdef HTTP_ASYNC_BACKEND
+    ArUploadHandlerFunction onUpload = nullptr;
+    ArBodyHandlerFunction onBody = nullptr;
+    if (body) {
+        // Multipart parts and raw bodies end up in the same sink
+        onUpload = [body](AsyncWebServerRequest* r, const String&, size_t index, uint8_t* data, size_t len, bool) {
+            HttpRequest req(r);
+            body(req, data, len, index, 0);
+        };
+        onBody = [body](AsyncWebServerRequest* r, uint8_t* data, size_t len, size_t index, size_t total) {
+            HttpRequest req(r);
+            body(req, data, len, index, total);
+        };
+    }
+    server.addHandler(new ExactRouteHandler(uri, method, [handler, metrics](AsyncWebServerRequest* r) {
+        HttpRequest req(r, metrics);
+        runTimed(handler, req, metrics);
+    }, onUpload, onBody));
+#else
+    if (body && kind == BODY_RAW) {
+        server.on(uri, method, [handler, metrics]() {
+            HttpRequest req(metrics);
+            runTimed(handler, req, metrics);
+        }, [body]() {
+            // Reads of up to HTTP_RAW_BUFLEN bytes straight off the socket
+            HTTPRaw& raw = server.raw();
+            if (raw.status == RAW_WRITE) {
+                HttpRequest req;
+                // totalSize already includes this chunk
+                body(req, raw.buf, raw.currentSize, raw.totalSize - raw.currentSize, 0);
+            }
+        });
+    } else if (body) {
+        server.on(uri, method, [handler, metrics]() {
+            HttpRequest req(metrics);
+            runTimed(handler, req, metrics);
+        }, [body]() {
+            HTTPUpload& up = server.upload();
+            if (up.status == UPLOAD_FILE_WRITE) {
+                HttpRequest req;
+                // totalSize has not yet been advanced past this chunk
+                body(req, up.buf, up.currentSize, up.totalSize, 0);
+            }
+        });
+    } else {
+        server.on(uri, method, [handler, metrics]() {
+            HttpRequest req(metrics);
+            runTimed(handler, req, metrics);
+        });
+    }
+#endif
+}
+
+// Request headers the sync WebServer must retain for handlers
+const char* HTTP_COLLECT_HEADERS[] = { "If-None-Match" };
+
+/**
+ * @brief Start listening on whichever backend is compiled in
+ */
+void startHttpServer() {
+#ifndef HTTP_ASYNC_BACKEND
+    server.collectHeaders(HTTP_COLLECT_HEADERS, sizeof(HTTP_COLLECT_HEADERS) / sizeof(HTTP_COLLECT_HEADERS[0]));
+#endif
+    server.begin();
+}
+
+/**
+ * @brief Register the fallback handler for unmatched URIs
+ */
+void setNotFoundHandler(HttpHandler handler) {
+#ifdef HTTP_ASYNC_BACKEND
+    server.onNotFound([handler](AsyncWebServerRequest* r) {
+        HttpRequest req(r);
+        handler(req);
+    });
+#else
+    server.onNotFound([handler]() {
+        HttpRequest req;
+        handler(req);
+    });
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Raw Throughput Server (iperf2 compatible)
+// -------------------------------------------------------------------------
+// Measures what the radio can sustain without HTTP framing or multipart
+// parsing. Standard tooling can drive it directly:
+//   iperf -c 192.168.4.1 -t 10 [-P 4]          (TCP, client -> ESP)
+//   iperf -c 192.168.4.1 -u -b 20M -t 10       (UDP, client -> ESP)
+// The server side is a sink: TCP data is discarded in large reads, UDP
+// datagrams are checked for sequence gaps and jitter and the final datagram
+// is acknowledged with an iperf2 server report so the client prints loss
+// and jitter as seen by the ESP. Runs on its own FreeRTOS tasks (ESP32).
+
+const uint16_t IPERF_PORT = 5001;
+
+/**
+ * @brief Counters for the current (or last finished) iperf run
+ */
+struct IperfStats {
+    volatile bool     active;       // Transfer in progress
+    volatile uint64_t bytes;        // Payload received in this run
+    volatile uint32_t start_ms;     // First byte of the run
+    volatile uint32_t last_ms;      // Most recent byte of the run
+    uint32_t runs;                  // Completed runs since boot
+    uint8_t  connections;           // TCP: open sockets in this run
+    // UDP only
+    uint32_t datagrams;             // Datagrams received
+    uint32_t lost;                  // Sequence gaps
+    uint32_t out_of_order;          // Datagrams older than expected
+    uint32_t duplicates;            // Sequence numbers seen twice
+    uint32_t reorder_max;           // Furthest a late datagram arrived behind
+    float    jitter_ms;             // RFC 1889 inter-arrival jitter
+};
+IperfStats iperf_tcp = {};
+IperfStats iperf_udp = {};
+
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+const int IPERF_MAX_TCP_CLIENTS = 4;      // Enough for iperf -P 4
+const size_t IPERF_RX_BUF_SIZE = 8192;    // One large read per recv()
+const int IPERF_SEEN_WINDOW = 256;        // Datagrams remembered for duplicate detection
+
+/**
+ * @brief iperf2 (2.0.x) UDP payload header, network byte order
+ *
+ * iperf2 reads its client_hdr (flags, thread count, port, ...) right after
+ * this header. Senders must zero IPERF_CLIENT_HDR_SIZE bytes there, or a
+ * set HEADER_VERSION1 bit makes the server try to connect back for a
+ * dual test.
+ */
+struct IperfUdpDatagram {
+    int32_t  id;        // Sequence number, negative on the final datagram
+    uint32_t tv_sec;    // Client send time
+    uint32_t tv_usec;
+};
+const size_t IPERF_CLIENT_HDR_SIZE = 64;    // client_hdr plus its extensions
+
+/**
+ * @brief iperf2 server report returned in reply to the final datagram
+ */
+struct IperfServerReport {
+    int32_t flags;
+    int32_t total_len1;     // Bytes received, upper 32 bits
+    int32_t total_len2;     // Bytes received, lower 32 bits
+    int32_t stop_sec;       // Run duration
+    int32_t stop_usec;
+    int32_t error_cnt;      // Lost datagrams
+    int32_t outorder_cnt;
+    int32_t datagrams;
+    int32_t jitter1;        // Jitter, seconds part
+    int32_t jitter2;        // Jitter, microseconds part
+};
+const int32_t IPERF_HEADER_VERSION1 = 0x80000000;
+
+/**
+ * @brief TCP sink: accepts up to IPERF_MAX_TCP_CLIENTS parallel streams
+ */
+void iperfTcpTask(void* arg) {
+    alignas(4) static uint8_t rx[IPERF_RX_BUF_SIZE];
+
+    int listenFd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(IPERF_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, IPERF_MAX_TCP_CLIENTS) != 0) {
+        Serial.println("iperf TCP: bind/listen failed");
+        close(listenFd);
+        taskExit();
+        return;
+    }
+
+    int clients[IPERF_MAX_TCP_CLIENTS];
+    uint32_t clientIps[IPERF_MAX_TCP_CLIENTS];
+    for (int i = 0; i < IPERF_MAX_TCP_CLIENTS; i++) clients[i] = -1;
+    uint32_t runStreams = 0;    // Connections accepted in this run
+
+    for (;;) {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(listenFd, &readSet);
+        int maxFd = listenFd;
+        for (int i = 0; i < IPERF_MAX_TCP_CLIENTS; i++) {
+            if (clients[i] >= 0) {
+                FD_SET(clients[i], &readSet);
+                if (clients[i] > maxFd) maxFd = clients[i];
+            }
+        }
+        if (select(maxFd + 1, &readSet, NULL, NULL, NULL) <= 0) continue;
+
+        if (FD_ISSET(listenFd, &readSet)) {
+            sockaddr_in peer;
+            socklen_t peerLen = sizeof(peer);
+            int fd = accept(listenFd, (sockaddr*)&peer, &peerLen);
+            int slot = -1;
+            for (int i = 0; i < IPERF_MAX_TCP_CLIENTS; i++) {
+                if (clients[i] < 0) { slot = i; break; }
+            }
+            if (fd >= 0 && slot >= 0) {
+                clients[slot] = fd;
+                clientIps[slot] = peer.sin_addr.s_addr;
+                stationAccount(clientIps[slot], 0, 0, true);
+                if (!iperf_tcp.active) {
+                    // First stream opens a new run
+                    iperf_tcp.bytes = 0;
+                    iperf_tcp.start_ms = millis();
+                    iperf_tcp.last_ms = iperf_tcp.start_ms;
+                    iperf_tcp.active = true;
+                    runStreams = 0;
+                    netstatsMark("iperf_tcp");
+                }
+                iperf_tcp.connections++;
+                runStreams++;
+            } else if (fd >= 0) {
+                close(fd); // All slots busy
+            }
+        }
+
+        for (int i = 0; i < IPERF_MAX_TCP_CLIENTS; i++) {
+            if (clients[i] < 0 || !FD_ISSET(clients[i], &readSet)) continue;
+            int n = recv(clients[i], rx, sizeof(rx), 0);
+            if (n > 0) {
+                iperf_tcp.bytes += n;
+                iperf_tcp.last_ms = millis();
+                STATS_LOCK();
+                traffic_rx_bytes += n;
+                STATS_UNLOCK();
+                stationAccount(clientIps[i], 0, n);
+            } else {
+                close(clients[i]);
+                clients[i] = -1;
+                if (--iperf_tcp.connections == 0) {
+                    iperf_tcp.active = false;
+                    iperf_tcp.runs++;
+                    resultsLog(RESULT_IPERF_TCP, runStreams, 0,
+                               toMbps(iperf_tcp.bytes, (int64_t)(iperf_tcp.last_ms - iperf_tcp.start_ms) * 1000),
+                               iperf_tcp.bytes / 1e6f);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief UDP sink: tracks loss/order/jitter and answers the final datagram
+ */
+void iperfUdpTask(void* arg) {
+    alignas(4) static uint8_t rx[2048];
+
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(IPERF_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        Serial.println("iperf UDP: bind failed");
+        close(fd);
+        taskExit();
+        return;
+    }
+
+    int32_t expected = 0;
+    int64_t lastTransit = 0;
+    int64_t startUs = 0, lastUs = 0;
+    float jitterUs = 0;
+    // Sequence number last stored in each slot (id % window), -1: empty
+    static int32_t seen[IPERF_SEEN_WINDOW];
+
+    for (;;) {
+        sockaddr_in peer;
+        socklen_t peerLen = sizeof(peer);
+        int n = recvfrom(fd, rx, sizeof(rx), 0, (sockaddr*)&peer, &peerLen);
+        if (n < (int)sizeof(IperfUdpDatagram)) continue;
+
+        int64_t nowUs = esp_timer_get_time();
+        IperfUdpDatagram* hdr = (IperfUdpDatagram*)rx;
+        int32_t id = (int32_t)ntohl(hdr->id);
+
+        if (id < 0) {
+            // Final datagram: close the run once, but acknowledge every
+            // retransmitted FIN since the client retries until it gets one.
+            if (iperf_udp.active) {
+                iperf_udp.active = false;
+                iperf_udp.runs++;
+                uint32_t expectedDatagrams = iperf_udp.datagrams + iperf_udp.lost;
+                resultsLog(RESULT_IPERF_UDP, iperf_udp.datagrams, iperf_udp.lost,
+                           toMbps(iperf_udp.bytes, lastUs - startUs),
+                           expectedDatagrams ? iperf_udp.lost * 100.0f / expectedDatagrams : 0, iperf_udp.jitter_ms);
+            }
+            if (n < (int)(sizeof(IperfUdpDatagram) + sizeof(IperfServerReport))) continue;
+
+            int64_t duration = lastUs - startUs;
+            uint64_t total = iperf_udp.bytes;
+            IperfServerReport* rep = (IperfServerReport*)(rx + sizeof(IperfUdpDatagram));
+            rep->flags = htonl(IPERF_HEADER_VERSION1);
+            rep->total_len1 = htonl((uint32_t)(total >> 32));
+            rep->total_len2 = htonl((uint32_t)(total & 0xFFFFFFFF));
+            rep->stop_sec = htonl((int32_t)(duration / 1000000));
+            rep->stop_usec = htonl((int32_t)(duration % 1000000));
+            rep->error_cnt = htonl(iperf_udp.lost);
+            rep->outorder_cnt = htonl(iperf_udp.out_of_order);
+            rep->datagrams = htonl(iperf_udp.datagrams);
+            rep->jitter1 = htonl((int32_t)(jitterUs / 1000000));
+            rep->jitter2 = htonl((int32_t)fmodf(jitterUs, 1000000));
+            sendto(fd, rx, n, 0, (sockaddr*)&peer, peerLen);
+            continue;
+        }
+
+        if (!iperf_udp.active) {
+            // New run
+            iperf_udp.bytes = 0;
+            iperf_udp.datagrams = 0;
+            iperf_udp.lost = 0;
+            iperf_udp.out_of_order = 0;
+            iperf_udp.duplicates = 0;
+            iperf_udp.reorder_max = 0;
+            memset(seen, 0xFF, sizeof(seen));
+            iperf_udp.start_ms = millis();
+            iperf_udp.active = true;
+            netstatsMark("iperf_udp");
+            stationAccount(peer.sin_addr.s_addr, 0, 0, true);
+            expected = 0;
+            lastTransit = 0;
+            jitterUs = 0;
+            startUs = nowUs;
+        }
+
+        iperf_udp.bytes += n;
+        stationAccount(peer.sin_addr.s_addr, 0, n);
+        iperf_udp.datagrams++;
+        STATS_LOCK();
+        traffic_rx_bytes += n;
+        STATS_UNLOCK();
+        iperf_udp.last_ms = millis();
+        lastUs = nowUs;
+
+        // Sequence accounting, same rules as the iperf2 server, except that
+        // a repeat within the window is a duplicate rather than a late arrival
+        int32_t& slot = seen[id % IPERF_SEEN_WINDOW];
+        if (slot == id) {
+            iperf_udp.duplicates++;
+        } else if (id >= expected) {
+            iperf_udp.lost += id - expected;
+            expected = id + 1;
+        } else {
+            iperf_udp.out_of_order++;
+            if (iperf_udp.lost > 0) iperf_udp.lost--;
+            uint32_t depth = expected - 1 - id;
+            if (depth > iperf_udp.reorder_max) iperf_udp.reorder_max = depth;
+        }
+        slot = id;
+
+        // Jitter over transit time; the clock offset cancels out
+        int64_t sentUs = (int64_t)ntohl(hdr->tv_sec) * 1000000 + ntohl(hdr->tv_usec);
+        int64_t transit = nowUs - sentUs;
+        if (lastTransit != 0) {
+            int64_t d = transit - lastTransit;
+            if (d < 0) d = -d;
+            jitterUs += (d - jitterUs) / 16.0f;
+        }
+        lastTransit = transit;
+        iperf_udp.jitter_ms = jitterUs / 1000.0f;
+    }
+}
+#endif
+
+/**
+ * @brief Start the iperf TCP and UDP sinks on IPERF_PORT
+ */
+void startIperfServer() {
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+    startTask(iperfTcpTask, "iperf_tcp", 4096, TRAFFIC_TASK_PRIORITY, TRAFFIC_CORE);
+    startTask(iperfUdpTask, "iperf_udp", 4096, TRAFFIC_TASK_PRIORITY, TRAFFIC_CORE);
+    Serial.printf("iperf server listening on TCP/UDP %u\n", IPERF_PORT);
+#endif
+}
+
+// -------------------------------------------------------------------------
+// UDP Blast Generator
+// -------------------------------------------------------------------------
+// TCP backs off on loss, so a TCP test reports congestion control as much as
+// the radio. The blast generator sends UDP at a fixed bitrate whether or not
+// packets get through, so loss shows up as loss. Datagrams use the iperf2
+// format (sequence number plus send time), so any iperf2 server receives
+// them:
+//   iperf -s -u -i 1                          (on the laptop)
+//   GET /api/udpblast?start=1&rate_kbps=20000&size=1470&duration_ms=10000
+// The target defaults to the client that starts the run. Sends are paced
+// against an absolute schedule (start + n x interval) from esp_timer, which
+// wakes the task every interval (or every BLAST_MIN_PERIOD_US at high rates,
+// sending whatever is due). After the last datagram the generator sends
+// iperf2 FIN datagrams until the server replies with its report. The report
+// gives loss, reordering and jitter as seen by the receiver, next to the
+// sends the device's own stack refused (send_errors), which are not RF loss.
+// The iperf UDP sink above analyses the opposite direction. ESP32 only.
+
+const uint16_t BLAST_DEFAULT_PORT = IPERF_PORT;
+const uint32_t BLAST_MIN_PERIOD_US = 500;   // Fastest esp_timer wakeup
+const uint32_t BLAST_MAX_BURST = 16;        // Datagrams per wakeup when catching up
+const size_t BLAST_MIN_SIZE = sizeof(int32_t) * 3;
+const size_t BLAST_MAX_SIZE = 1472;         // One unfragmented datagram
+const uint32_t BLAST_MAX_DURATION_MS = 60000;
+const int BLAST_FIN_TRIES = 10;             // Report requests, 250 ms apart
+
+/**
+ * @brief Settings and results of the current (or last finished) blast
+ */
+struct BlastReport {
+    volatile bool active;
+    volatile bool stop;         // Ask the task to end the run early
+    uint32_t runs;
+    // Settings
+    uint32_t target_ip;         // Network byte order
+    uint16_t port;
+    uint16_t size;              // UDP payload bytes
+    uint32_t rate_kbps;
+    uint32_t duration_ms;
+    // Sender side
+    uint32_t sent;
+    uint64_t bytes;
+    uint32_t send_errors;       // Refused by the local stack (no buffers)
+    uint32_t late;              // Wakeups that hit BLAST_MAX_BURST, rate not kept
+    int64_t  start_us, end_us;
+    // Receiver side, from the iperf2 server report
+    bool     has_report;
+    uint32_t rx_datagrams;
+    uint32_t rx_lost;
+    uint32_t rx_out_of_order;
+    uint64_t rx_bytes;
+    uint32_t rx_duration_ms;
+    float    rx_jitter_ms;
+};
+BlastReport blast = {};
+
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+TaskHandle_t blast_task = NULL;
+esp_timer_handle_t blast_timer = NULL;
+
+/**
+ * @brief Pacing tick: wake the blast task
+ */
+void blastTick(void* arg) {
+    xTaskNotifyGive(blast_task);
+}
+
+/**
+ * @brief Send FINs until the iperf2 server answers with its report
+ */
+void blastCollectReport(int fd, uint8_t* buf) {
+    timeval tv = { 0, 250000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    IperfUdpDatagram* hdr = (IperfUdpDatagram*)buf;
+    hdr->id = htonl(-(int32_t)(blast.sent > 0 ? blast.sent : 1));
+    for (int i = 0; i < BLAST_FIN_TRIES; i++) {
+        send(fd, buf, blast.size, 0);
+        int n = recv(fd, buf + BLAST_MAX_SIZE, BLAST_MAX_SIZE, 0);
+        if (n < (int)(sizeof(IperfUdpDatagram) + sizeof(IperfServerReport))) continue;
+        const IperfServerReport* rep = (const IperfServerReport*)(buf + BLAST_MAX_SIZE + sizeof(IperfUdpDatagram));
+        blast.rx_bytes = ((uint64_t)ntohl(rep->total_len1) << 32) | ntohl(rep->total_len2);
+        blast.rx_duration_ms = ntohl(rep->stop_sec) * 1000 + ntohl(rep->stop_usec) / 1000;
+        blast.rx_lost = ntohl(rep->error_cnt);
+        blast.rx_out_of_order = ntohl(rep->outorder_cnt);
+        blast.rx_datagrams = ntohl(rep->datagrams);
+        blast.rx_jitter_ms = (int32_t)ntohl(rep->jitter1) * 1000.0f + (int32_t)ntohl(rep->jitter2) / 1000.0f;
+        blast.has_report = true;
+        return;
+    }
+}
+
+/**
+ * @brief Generator task: one run per notification
+ */
+void blastTask(void* arg) {
+    // Datagram, then room for the server report
+    alignas(4) static uint8_t buf[BLAST_MAX_SIZE * 2];
+
+    for (;;) {
+        while (!blast.active) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(blast.port);
+        addr.sin_addr.s_addr = blast.target_ip;
+        if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd >= 0) close(fd);
+            blast.active = false;
+            continue;
+        }
+
+        memcpy(buf, tx_payload, blast.size);
+        // No client_hdr: a plain one-way test for iperf -s -u
+        memset(buf + sizeof(IperfUdpDatagram), 0,
+               min(IPERF_CLIENT_HDR_SIZE, blast.size - sizeof(IperfUdpDatagram)));
+        IperfUdpDatagram* hdr = (IperfUdpDatagram*)buf;
+        uint32_t intervalUs = (uint64_t)blast.size * 8000 / blast.rate_kbps;
+        if (intervalUs == 0) intervalUs = 1;
+        int64_t durationUs = (int64_t)blast.duration_ms * 1000;
+
+        netstatsMark("udp_blast");
+        stationAccount(blast.target_ip, 0, 0, true);
+        ulTaskNotifyTake(pdTRUE, 0);
+        blast.start_us = esp_timer_get_time();
+        esp_timer_start_periodic(blast_timer, max(intervalUs, BLAST_MIN_PERIOD_US));
+
+        int64_t now = blast.start_us;
+        while (!blast.stop && now - blast.start_us < durationUs) {
+            // Everything scheduled up to now, from an absolute timeline
+            uint64_t due = (now - blast.start_us) / intervalUs + 1;
+            uint32_t burst = 0;
+            while (blast.sent < due && burst < BLAST_MAX_BURST) {
+                hdr->id = htonl(blast.sent);
+                hdr->tv_sec = htonl((uint32_t)(now / 1000000));
+                hdr->tv_usec = htonl((uint32_t)(now % 1000000));
+                if (send(fd, buf, blast.size, 0) < 0) {
+                    // Out of pbufs: retry the same id on the next wakeup so
+                    // the receiver's loss stays radio loss
+                    blast.send_errors++;
+                    break;
+                }
+                blast.sent++;
+                blast.bytes += blast.size;
+                burst++;
+                STATS_LOCK();
+                traffic_tx_bytes += blast.size;
+                STATS_UNLOCK();
+            }
+            if (burst == BLAST_MAX_BURST && blast.sent < due) blast.late++;
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            now = esp_timer_get_time();
+        }
+        esp_timer_stop(blast_timer);
+        blast.end_us = esp_timer_get_time();
+        stationAccount(blast.target_ip, blast.bytes, 0);
+
+        blastCollectReport(fd, buf);
+        close(fd);
+        if (blast.has_report) {
+            resultsLog(RESULT_UDP_BLAST, blast.rate_kbps, blast.size,
+                       toMbps(blast.rx_bytes, (int64_t)blast.rx_duration_ms * 1000),
+                       blast.sent ? blast.rx_lost * 100.0f / blast.sent : 0, blast.rx_jitter_ms);
+        }
+        blast.runs++;
+        blast.active = false;
+    }
+}
+#endif
+
+/**
+ * @brief Start a blast run unless one is in progress
+ * @return False if busy or unsupported
+ */
+bool requestBlast(uint32_t ip, uint16_t port, uint32_t rateKbps, size_t size, uint32_t durationMs) {
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+    if (!blast_task || blast.active || ip == 0) return false;
+    uint32_t runs = blast.runs;
+    blast = {};
+    blast.runs = runs;
+    blast.target_ip = ip;
+    blast.port = port;
+    blast.size = constrain(size, BLAST_MIN_SIZE, min(BLAST_MAX_SIZE, tx_payload_size));
+    blast.rate_kbps = max(rateKbps, (uint32_t)8);
+    blast.duration_ms = constrain(durationMs, (uint32_t)100, BLAST_MAX_DURATION_MS);
+    blast.active = true;
+    xTaskNotifyGive(blast_task);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Create the generator task and its pacing timer
+ */
+void startBlastGenerator() {
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+    if (!startTask(blastTask, "udp_blast", 4096, TRAFFIC_TASK_PRIORITY + 1, TRAFFIC_CORE, &blast_task)) return;
+    esp_timer_create_args_t args = {};
+    args.callback = blastTick;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "udp_blast";
+    esp_timer_create(&args, &blast_timer);
+#endif
+}
+
+#if FEATURE_CLIENT_TESTS
+// -------------------------------------------------------------------------
+// Station-mode Client Tests
+// -------------------------------------------------------------------------
+// Measures the ESP as a client of an upstream AP, while the soft-AP stays
+// up. POST /api/sta action=connect joins a network, then action=test runs
+// against a remote host reached through it:
+//   latency  - TCP handshakes to host:port, timed with esp_timer
+//   upload   - TCP stream to host:port for duration_ms (iperf -s, or any sink)
+//   download - HTTP GET http://host:http_port/path, body timed until the end
+//              or duration_ms
+// The radio has one channel, so the soft-AP moves to the upstream AP's
+// channel when the STA joins, and its clients reassociate. The channel
+// analyzer and /api/channel moves are refused while the STA is connected.
+//
+// The IDF does not expose the current STA TX rate or MCS, so the link is
+// described by the negotiated PHY mode and bandwidth, plus the top rate
+// they allow. Tests run on their own task on the traffic core (ESP32 only).
+
+const uint16_t STA_DEFAULT_PORT = IPERF_PORT;
+const uint32_t STA_DEFAULT_DURATION_MS = 5000;
+const int STA_LATENCY_PROBES = 20;
+const uint32_t STA_CONNECT_TIMEOUT_MS = 3000;
+
+/**
+ * @brief Which tests a run includes
+ */
+enum StaTests {
+    STA_TEST_LATENCY  = 1,
+    STA_TEST_UPLOAD   = 2,
+    STA_TEST_DOWNLOAD = 4,
+    STA_TEST_ALL      = 7
+};
+
+/**
+ * @brief Throughput of one client transfer
+ */
+struct ClientTransfer {
+    bool     done;
+    uint64_t bytes;
+    uint32_t duration_ms;
+    char     error[32];     // "" on success
+};
+
+/**
+ * @brief TCP handshake times of one latency probe series
+ */
+struct ClientLatency {
+    uint16_t probes, failed;
+    uint32_t min_us, avg_us, max_us;
+};
+
+/**
+ * @brief Settings and results of the current (or last finished) STA run
+ */
+struct StaRun {
+    volatile bool active;
+    uint32_t runs;
+    uint8_t  tests;         // StaTests bits
+    char     host[64];
+    uint16_t port;          // TCP port for latency and upload
+    uint16_t http_port;
+    char     path[96];
+    uint32_t duration_ms;
+    uint32_t remote_ip;     // Resolved host, network byte order
+    char     error[32];     // Run-level failure, e.g. resolve
+    ClientLatency  latency;
+    ClientTransfer upload;
+    ClientTransfer download;
+};
+StaRun sta_run = {};
+char sta_ssid[33] = "";
+
+#ifdef ESP32
+TaskHandle_t sta_task = NULL;
+
+// The client probes below are shared with the test sequencer. They block,
+// so they only run from a test task, never from an HTTP handler.
+
+/**
+ * @brief Time repeated TCP handshakes to ip:port
+ */
+void clientLatency(const IPAddress& ip, uint16_t port, int probes, ClientLatency& out) {
+    out = {};
+    uint64_t total = 0;
+    for (int i = 0; i < probes; i++) {
+        WiFiClient client;
+        int64_t start = esp_timer_get_time();
+        bool ok = client.connect(ip, port, STA_CONNECT_TIMEOUT_MS);
+        uint32_t us = esp_timer_get_time() - start;
+        client.stop();
+        if (!ok) {
+            out.failed++;
+            continue;
+        }
+        if (out.probes == 0 || us < out.min_us) out.min_us = us;
+        if (us > out.max_us) out.max_us = us;
+        total += us;
+        out.probes++;
+        out.avg_us = total / out.probes;
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+}
+
+/**
+ * @brief Stream the shared payload to ip:port over parallel TCP connections
+ * Non-blocking sends, round-robin over the streams; select() waits for room.
+ */
+void clientSend(const IPAddress& ip, uint16_t port, uint32_t durationMs, int streams, ClientTransfer& t) {
+    t = {};
+    WiFiClient clients[MAX_DOWNLOAD_STREAMS];
+    streams = constrain(streams, 1, MAX_DOWNLOAD_STREAMS);
+    int open = 0;
+    for (int i = 0; i < streams; i++) {
+        if (!clients[i].connect(ip, port, STA_CONNECT_TIMEOUT_MS)) continue;
+        clients[i].setNoDelay(tcp_no_delay);
+        open++;
+    }
+    if (open == 0) {
+        strlcpy(t.error, "connect failed", sizeof(t.error));
+        t.done = true;
+        return;
+    }
+
+    size_t chunk = downloadChunk(0);
+    uint32_t start = millis();
+    while (open > 0 && millis() - start < durationMs) {
+        fd_set writeSet;
+        FD_ZERO(&writeSet);
+        int maxFd = -1;
+        for (int i = 0; i < streams; i++) {
+            int fd = clients[i].connected() ? clients[i].fd() : -1;
+            if (fd < 0) continue;
+            int n = ::send(fd, tx_payload, chunk, MSG_DONTWAIT);
+            if (n > 0) {
+                t.bytes += n;
+                STATS_LOCK();
+                traffic_tx_bytes += n;
+                STATS_UNLOCK();
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                clients[i].stop(); // Peer gone
+                open--;
+                continue;
+            }
+            FD_SET(fd, &writeSet);
+            if (fd > maxFd) maxFd = fd;
+        }
+        if (maxFd < 0) break;
+        timeval tv = { 0, 100000 };
+        select(maxFd + 1, NULL, &writeSet, NULL, &tv);
+    }
+    t.duration_ms = millis() - start;
+    if (open == 0) strlcpy(t.error, "closed by peer", sizeof(t.error));
+    for (int i = 0; i < streams; i++) clients[i].stop();
+    t.done = true;
+}
+
+/**
+ * @brief Read up to the end of an HTTP response header
+ * @return False on timeout or close before the body
+ */
+bool clientSkipHeader(WiFiClient& client) {
+    uint32_t start = millis();
+    uint32_t match = 0;
+    while (match < 4 && millis() - start < STA_CONNECT_TIMEOUT_MS && client.connected()) {
+        int c = client.read();
+        if (c < 0) {
+            vTaskDelay(1);
+            continue;
+        }
+        match = c == "\r\n\r\n"[match] ? match + 1 : (c == '\r' ? 1 : 0);
+    }
+    return match == 4;
+}
+
+/**
+ * @brief HTTP GET http://host:port/path from ip over parallel connections
+ * The timer starts once every header is read; it stops at duration_ms or
+ * when the last body ends.
+ */
+void clientFetch(const IPAddress& ip, uint16_t port, const char* host, const char* path, uint32_t durationMs,
+                 int streams, ClientTransfer& t) {
+    static uint8_t rx[4096];
+    t = {};
+    WiFiClient clients[MAX_DOWNLOAD_STREAMS];
+    bool open[MAX_DOWNLOAD_STREAMS] = {};
+    streams = constrain(streams, 1, MAX_DOWNLOAD_STREAMS);
+    int connected = 0, remaining = 0;
+    for (int i = 0; i < streams; i++) {
+        if (!clients[i].connect(ip, port, STA_CONNECT_TIMEOUT_MS)) continue;
+        connected++;
+        clients[i].printf("GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+        open[i] = true;
+    }
+    for (int i = 0; i < streams; i++) {
+        if (!open[i]) continue;
+        open[i] = clientSkipHeader(clients[i]);
+        if (open[i]) remaining++;
+        else clients[i].stop();
+    }
+    if (remaining == 0) {
+        strlcpy(t.error, connected ? "no HTTP response" : "connect failed", sizeof(t.error));
+        t.done = true;
+        return;
+    }
+
+    uint32_t start = millis();
+    while (remaining > 0 && millis() - start < durationMs) {
+        bool idle = true;
+        for (int i = 0; i < streams; i++) {
+            if (!open[i]) continue;
+            int n = clients[i].read(rx, sizeof(rx));
+            if (n > 0) {
+                idle = false;
+                t.bytes += n;
+                STATS_LOCK();
+                traffic_rx_bytes += n;
+                STATS_UNLOCK();
+            } else if (!clients[i].connected()) {
+                open[i] = false; // Body complete
+                remaining--;
+            }
+        }
+        if (idle) vTaskDelay(1);
+    }
+    t.duration_ms = millis() - start;
+    for (int i = 0; i < streams; i++) clients[i].stop();
+    t.done = true;
+}
+
+/**
+ * @brief Test task: one run per notification
+ */
+void staTask(void* arg) {
+    for (;;) {
+        while (!sta_run.active) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        IPAddress ip;
+        if (!WiFi.hostByName(sta_run.host, ip)) {
+            strlcpy(sta_run.error, "cannot resolve host", sizeof(sta_run.error));
+        } else {
+            sta_run.remote_ip = (uint32_t)ip;
+            netstatsMark("sta");
+            if (sta_run.tests & STA_TEST_LATENCY) {
+                clientLatency(ip, sta_run.port, STA_LATENCY_PROBES, sta_run.latency);
+            }
+            if (sta_run.tests & STA_TEST_UPLOAD) {
+                clientSend(ip, sta_run.port, sta_run.duration_ms, 1, sta_run.upload);
+            }
+            if (sta_run.tests & STA_TEST_DOWNLOAD) {
+                clientFetch(ip, sta_run.http_port, sta_run.host, sta_run.path, sta_run.duration_ms, 1, sta_run.download);
+            }
+            resultsLog(RESULT_STA, sta_run.tests, 0,
+                       toMbps(sta_run.upload.bytes, (int64_t)sta_run.upload.duration_ms * 1000),
+                       toMbps(sta_run.download.bytes, (int64_t)sta_run.download.duration_ms * 1000),
+                       sta_run.latency.avg_us / 1000.0f);
+        }
+        sta_run.runs++;
+        sta_run.active = false;
+    }
+}
+#endif
+
+/**
+ * @brief Start a STA test run
+ * @return False if a run is active, the STA is not connected, or unsupported
+ */
+bool requestStaRun(const String& host, uint16_t port, uint16_t httpPort, const String& path,
+                   uint32_t durationMs, uint8_t tests) {
+#ifdef ESP32
+    if (!sta_task || sta_run.active || WiFi.status() != WL_CONNECTED) return false;
+    uint32_t runs = sta_run.runs;
+    sta_run = {};
+    sta_run.runs = runs;
+    sta_run.tests = tests;
+    strlcpy(sta_run.host, host.c_str(), sizeof(sta_run.host));
+    strlcpy(sta_run.path, path.length() ? path.c_str() : "/", sizeof(sta_run.path));
+    sta_run.port = port;
+    sta_run.http_port = httpPort;
+    sta_run.duration_ms = constrain(durationMs, (uint32_t)1000, (uint32_t)60000);
+    sta_run.active = true;
+    xTaskNotifyGive(sta_task);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Name and top PHY rate of the link negotiated with the upstream AP
+ * @return Mbps ceiling for the mode and bandwidth, 0 when not connected
+ */
+float staLinkMode(const char*& mode) {
+    mode = "";
+#ifdef ESP32
+    wifi_phy_mode_t phy;
+    if (WiFi.status() != WL_CONNECTED || esp_wifi_sta_get_negotiated_phymode(&phy) != ESP_OK) return 0;
+    switch (phy) {
+        case WIFI_PHY_MODE_11B:  mode = "11b";  return 11;
+        case WIFI_PHY_MODE_11G:  mode = "11g";  return 54;
+        case WIFI_PHY_MODE_HT20: mode = "HT20"; return 72.2f;   // MCS7, short GI
+        case WIFI_PHY_MODE_HT40: mode = "HT40"; return 150;
+        case WIFI_PHY_MODE_LR:   mode = "LR";   return 0.5f;
+        default: return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Create the STA test task
+ */
+void startStaTests() {
+#ifdef ESP32
+    startTask(staTask, "sta_test", 4096, TRAFFIC_TASK_PRIORITY, TRAFFIC_CORE, &sta_task);
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Test Sequencer
+// -------------------------------------------------------------------------
+// Runs a test plan without a browser: each test runs N times at each TX
+// power level, and the report gives min/mean/max/stddev per metric and
+// level. The peer is a host reachable from the device, either a soft-AP
+// client or a machine behind the STA uplink, running:
+//   iperf -s       TCP sink for "download" (device -> host) and latency
+//   iperf -s -u    UDP receiver for "udp" (the blast generator)
+//   an HTTP server serving a large file (path) for "upload" (host -> device)
+// Directions are named as in the dashboard: download is the device sending.
+//
+// A plan is a set of key=value settings:
+//   host, port (5001), http_port (80), path (/),
+//   tests=latency,download,upload,udp, iterations (3), streams (1..8),
+//   duration_ms (5000), udp_rate_kbps (10000), powers=2,8.5,19.5 (dBm)
+// POST /api/sequence takes them as parameters and starts the run. On the
+// serial console, one setting per line (or ';'-separated), then "run".
+// "report" prints the report, "abort" stops the run, "reset" restores the
+// defaults. The report is printed on the console once a run started there
+// finishes. ESP32 only.
+//
+// The power sweep (/api/powersweep) is a preset plan: one download burst to
+// the requesting client at every level the radio supports, from 2 dBm up.
+// Each level also records retransmits, disconnects and the peer's RSSI, so
+// the curve shows where throughput stops rising with power. A board whose
+// supply sags under TX load gets slower, or drops clients, at the top
+// levels instead.
+
+const int SEQ_MAX_POWERS = 12;
+const int SEQ_MAX_ITERATIONS = 20;
+const int SEQ_LATENCY_PROBES = 10;
+const uint32_t SEQ_SETTLE_MS = 1000;        // After a TX power change
+const uint32_t SEQ_GAP_MS = 200;            // Between tests, lets queues drain
+const size_t SEQ_UDP_SIZE = 1470;
+
+enum SeqTests {
+    SEQ_TEST_LATENCY  = 1,
+    SEQ_TEST_DOWNLOAD = 2,
+    SEQ_TEST_UPLOAD   = 4,
+    SEQ_TEST_UDP      = 8,
+    SEQ_TEST_ALL      = 15
+};
+
+enum SeqMetric {
+    SEQ_LATENCY_MS,
+    SEQ_DOWNLOAD_MBPS,
+    SEQ_UPLOAD_MBPS,
+    SEQ_UDP_MBPS,
+    SEQ_UDP_LOSS_PCT,
+    SEQ_UDP_JITTER_MS,
+    SEQ_RSSI_DBM,           // Peer RSSI, sampled before each iteration
+    SEQ_METRIC_COUNT
+};
+
+const char* SEQ_METRIC_NAMES[SEQ_METRIC_COUNT] = {
+    "latency_ms", "download_mbps", "upload_mbps", "udp_mbps", "udp_loss_pct", "udp_jitter_ms", "rssi_dbm"
+};
+const uint8_t SEQ_METRIC_TEST[SEQ_METRIC_COUNT] = {
+    SEQ_TEST_LATENCY, SEQ_TEST_DOWNLOAD, SEQ_TEST_UPLOAD, SEQ_TEST_UDP, SEQ_TEST_UDP, SEQ_TEST_UDP, SEQ_TEST_ALL
+};
+
+// Default levels: the dashboard's TX power buttons
+const float SEQ_DEFAULT_POWERS[] = { 2, 5, 8.5f, 11, 13, 15, 17, 19.5f };
+const int SEQ_DEFAULT_POWER_COUNT = sizeof(SEQ_DEFAULT_POWERS) / sizeof(SEQ_DEFAULT_POWERS[0]);
+
+// Power sweep levels: every step of the Arduino wifi_power_t table
+const float SEQ_SWEEP_POWERS[] = { 2, 5, 7, 8.5f, 11, 13, 15, 17, 18.5f, 19, 19.5f };
+const int SEQ_SWEEP_POWER_COUNT = sizeof(SEQ_SWEEP_POWERS) / sizeof(SEQ_SWEEP_POWERS[0]);
+const uint32_t SEQ_SWEEP_DURATION_MS = 3000;
+const float SEQ_SWEEP_DROP = 0.8f;          // Below this share of the peak: supply-limited
+
+/**
+ * @brief A test plan
+ */
+struct SeqPlan {
+    char     host[64];
+    uint16_t port;          // iperf -s (TCP and UDP)
+    uint16_t http_port;
+    char     path[96];
+    uint8_t  tests;         // SeqTests bits
+    uint8_t  iterations;
+    uint8_t  streams;       // Parallel TCP connections for download/upload
+    uint32_t duration_ms;
+    uint32_t udp_rate_kbps;
+    uint8_t  power_count;
+    float    powers[SEQ_MAX_POWERS];
+};
+
+/**
+ * @brief Running min/max/mean/variance (Welford)
+ */
+struct SeqStat {
+    uint16_t n;
+    float    min, max;
+    double   mean, m2;
+};
+
+/**
+ * @brief Results at one TX power level
+ */
+struct SeqLevel {
+    uint16_t failures;      // Tests that produced no sample
+    uint32_t retransmits;   // lwIP TCP retransmits during the level
+    uint32_t disconnects;   // disconnect_count delta during the level
+    SeqStat  metrics[SEQ_METRIC_COUNT];
+};
+
+/**
+ * @brief The current (or last finished) sequence run
+ */
+struct SeqRun {
+    volatile bool active;
+    volatile bool abort;
+    uint32_t runs;
+    SeqPlan  plan;
+    bool     sweep;             // Started as a power sweep
+    uint8_t  level, iteration;  // Progress
+    uint32_t start_ms, end_ms;
+    char     error[32];
+    SeqLevel levels[SEQ_MAX_POWERS];
+};
+SeqRun seq_run = {};
+SeqPlan seq_plan;               // Built up on the serial console
+bool seq_serial_report = false; // Print the report when the run finishes
+
+#ifdef ESP32
+TaskHandle_t seq_task = NULL;
+#endif
+
+/**
+ * @brief Reset a plan to the defaults (no host)
+ */
+void seqDefaultPlan(SeqPlan& p) {
+    p = {};
+    p.port = IPERF_PORT;
+    p.http_port = 80;
+    strlcpy(p.path, "/", sizeof(p.path));
+    p.tests = SEQ_TEST_ALL;
+    p.iterations = 3;
+    p.streams = 1;
+    p.duration_ms = STA_DEFAULT_DURATION_MS;
+    p.udp_rate_kbps = 10000;
+    p.power_count = SEQ_DEFAULT_POWER_COUNT;
+    memcpy(p.powers, SEQ_DEFAULT_POWERS, sizeof(SEQ_DEFAULT_POWERS));
+}
+
+/**
+ * @brief True if s fits and can go into a JSON string unescaped
+ */
+bool seqPlainText(const char* s, size_t cap) {
+    size_t len = strlen(s);
+    if (len == 0 || len >= cap) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < 0x20 || s[i] == '"' || s[i] == '\\') return false;
+    }
+    return true;
+}
+
+// Keys accepted by seqPlanSet, looked up as HTTP parameters
+const char* SEQ_PLAN_KEYS[] = {
+    "host", "port", "http_port", "path", "tests", "iterations", "streams", "duration_ms", "udp_rate_kbps", "powers"
+};
+
+/**
+ * @brief Apply one key=value setting to a plan
+ * @return False for an unknown key or an invalid value
+ */
+bool seqPlanSet(SeqPlan& p, const char* key, const char* value) {
+    long n = atol(value);
+    if (strcmp(key, "host") == 0) {
+        if (!seqPlainText(value, sizeof(p.host))) return false;
+        strlcpy(p.host, value, sizeof(p.host));
+    } else if (strcmp(key, "port") == 0 || strcmp(key, "http_port") == 0) {
+        if (n < 1 || n > 65535) return false;
+        (key[0] == 'p' ? p.port : p.http_port) = n;
+    } else if (strcmp(key, "path") == 0) {
+        if (value[0] != '/' || !seqPlainText(value, sizeof(p.path))) return false;
+        strlcpy(p.path, value, sizeof(p.path));
+    } else if (strcmp(key, "tests") == 0) {
+        uint8_t tests = 0;
+        if (strstr(value, "latency")) tests |= SEQ_TEST_LATENCY;
+        if (strstr(value, "download")) tests |= SEQ_TEST_DOWNLOAD;
+        if (strstr(value, "upload")) tests |= SEQ_TEST_UPLOAD;
+        if (strstr(value, "udp")) tests |= SEQ_TEST_UDP;
+        if (tests == 0) return false;
+        p.tests = tests;
+    } else if (strcmp(key, "iterations") == 0) {
+        if (n < 1 || n > SEQ_MAX_ITERATIONS) return false;
+        p.iterations = n;
+    } else if (strcmp(key, "streams") == 0) {
+        if (n < 1 || n > MAX_DOWNLOAD_STREAMS) return false;
+        p.streams = n;
+    } else if (strcmp(key, "duration_ms") == 0) {
+        if (n < 1000 || n > 60000) return false;
+        p.duration_ms = n;
+    } else if (strcmp(key, "udp_rate_kbps") == 0) {
+        if (n < 8) return false;
+        p.udp_rate_kbps = n;
+    } else if (strcmp(key, "powers") == 0) {
+        float powers[SEQ_MAX_POWERS];
+        int count = 0;
+        for (const char* s = value; *s; ) {
+            char* end;
+            float dbm = strtof(s, &end);
+            if (end == s || dbm < 2 || dbm > 19.5f || count == SEQ_MAX_POWERS) return false;
+            powers[count++] = dbm;
+            s = *end == ',' ? end + 1 : end;
+            if (*end && *end != ',') return false;
+        }
+        if (count == 0) return false;
+        memcpy(p.powers, powers, sizeof(float) * count);
+        p.power_count = count;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Format a SeqTests mask as a comma-separated list
+ */
+void seqFormatTests(char* out, size_t cap, uint8_t tests) {
+    snprintf(out, cap, "%s%s%s%s", tests & SEQ_TEST_LATENCY ? "latency," : "",
+             tests & SEQ_TEST_DOWNLOAD ? "download," : "", tests & SEQ_TEST_UPLOAD ? "upload," : "",
+             tests & SEQ_TEST_UDP ? "udp," : "");
+    size_t len = strlen(out);
+    if (len > 0) out[len - 1] = '\0';
+}
+
+/**
+ * @brief Add one sample to a running statistic
+ */
+void seqAdd(SeqStat& s, double x) {
+    s.n++;
+    if (s.n == 1 || x < s.min) s.min = x;
+    if (s.n == 1 || x > s.max) s.max = x;
+    double delta = x - s.mean;
+    s.mean += delta / s.n;
+    s.m2 += delta * (x - s.mean);
+}
+
+/**
+ * @brief Sample standard deviation (0 below two samples)
+ */
+double seqStddev(const SeqStat& s) {
+    return s.n > 1 ? sqrt(s.m2 / (s.n - 1)) : 0;
+}
+
+/**
+ * @brief RSSI of the peer at ip: its soft-AP station entry, else the uplink
+ * @return 0 when unknown
+ */
+int8_t peerRssi(uint32_t ip) {
+    uint8_t mac[6];
+    bool resolved = false;
+    STATS_LOCK();
+    for (int i = 0; i < MAX_STATIONS && !resolved; i++) {
+        if (station_stats[i].ip == ip && station_stats[i].resolved) {
+            memcpy(mac, station_stats[i].mac, 6);
+            resolved = true;
+        }
+    }
+    STATS_UNLOCK();
+    if (resolved) {
+        StationInfo stations[MAX_STATIONS];
+        int n = readStations(stations, MAX_STATIONS);
+        for (int i = 0; i < n; i++) {
+            if (memcmp(stations[i].mac, mac, 6) == 0) return stations[i].rssi;
+        }
+    }
+    return WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0;
+}
+
+#ifdef ESP32
+/**
+ * @brief One iteration of every test in the plan at the current power
+ */
+void seqIteration(const IPAddress& ip, const SeqPlan& p, SeqLevel& level) {
+    int8_t rssi = peerRssi((uint32_t)ip);
+    if (rssi != 0) seqAdd(level.metrics[SEQ_RSSI_DBM], rssi);
+    if ((p.tests & SEQ_TEST_LATENCY) && !seq_run.abort) {
+        ClientLatency lat;
+        clientLatency(ip, p.port, SEQ_LATENCY_PROBES, lat);
+        if (lat.probes > 0) seqAdd(level.metrics[SEQ_LATENCY_MS], lat.avg_us / 1000.0);
+        else level.failures++;
+        vTaskDelay(pdMS_TO_TICKS(SEQ_GAP_MS));
+    }
+    if ((p.tests & SEQ_TEST_DOWNLOAD) && !seq_run.abort) {
+        ClientTransfer t;
+        clientSend(ip, p.port, p.duration_ms, p.streams, t);
+        if (t.bytes > 0) seqAdd(level.metrics[SEQ_DOWNLOAD_MBPS], toMbps(t.bytes, (int64_t)t.duration_ms * 1000));
+        else level.failures++;
+        vTaskDelay(pdMS_TO_TICKS(SEQ_GAP_MS));
+    }
+    if ((p.tests & SEQ_TEST_UPLOAD) && !seq_run.abort) {
+        ClientTransfer t;
+        clientFetch(ip, p.http_port, p.host, p.path, p.duration_ms, p.streams, t);
+        if (t.bytes > 0) seqAdd(level.metrics[SEQ_UPLOAD_MBPS], toMbps(t.bytes, (int64_t)t.duration_ms * 1000));
+        else level.failures++;
+        vTaskDelay(pdMS_TO_TICKS(SEQ_GAP_MS));
+    }
+    if ((p.tests & SEQ_TEST_UDP) && !seq_run.abort) {
+        if (!requestBlast((uint32_t)ip, p.port, p.udp_rate_kbps, SEQ_UDP_SIZE, p.duration_ms)) {
+            level.failures++;
+            return;
+        }
+        while (blast.active) {
+            if (seq_run.abort) blast.stop = true;
+            vTaskDelay(pdMS_TO_TICKS(50));
+        }
+        if (blast.has_report && blast.sent > 0) {
+            seqAdd(level.metrics[SEQ_UDP_MBPS], toMbps(blast.rx_bytes, (int64_t)blast.rx_duration_ms * 1000));
+            seqAdd(level.metrics[SEQ_UDP_LOSS_PCT], blast.rx_lost * 100.0 / blast.sent);
+            seqAdd(level.metrics[SEQ_UDP_JITTER_MS], blast.rx_jitter_ms);
+        } else {
+            level.failures++;
+        }
+        vTaskDelay(pdMS_TO_TICKS(SEQ_GAP_MS));
+    }
+}
+
+/**
+ * @brief Sequencer task: one run per notification
+ */
+void seqTask(void* arg) {
+    for (;;) {
+        while (!seq_run.active) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        const SeqPlan& p = seq_run.plan;
+        IPAddress ip;
+        if (!WiFi.hostByName(p.host, ip)) {
+            strlcpy(seq_run.error, "cannot resolve host", sizeof(seq_run.error));
+        } else {
+            float original = currentTxPowerDbm();
+            netstatsMark("sequence");
+            for (int l = 0; l < p.power_count && !seq_run.abort; l++) {
+                seq_run.level = l;
+                if (!setTxPowerDbm(p.powers[l])) {
+                    strlcpy(seq_run.error, "TX power refused", sizeof(seq_run.error));
+                    break;
+                }
+                vTaskDelay(pdMS_TO_TICKS(SEQ_SETTLE_MS));
+                uint32_t rexmit = tcpRexmitCount();
+                uint32_t disconnects = disconnect_count;
+                for (int i = 0; i < p.iterations && !seq_run.abort; i++) {
+                    seq_run.iteration = i;
+                    seqIteration(ip, p, seq_run.levels[l]);
+                }
+                SeqLevel& level = seq_run.levels[l];
+                level.retransmits = tcpRexmitCount() - rexmit;
+                level.disconnects = disconnect_count - disconnects;
+                resultsLog(RESULT_SEQUENCE, lroundf(p.powers[l] * 100), p.tests,
+                           level.metrics[SEQ_DOWNLOAD_MBPS].mean, level.metrics[SEQ_UPLOAD_MBPS].mean,
+                           level.metrics[SEQ_LATENCY_MS].mean);
+            }
+            if (original > 0) setTxPowerDbm(original);
+            if (seq_run.abort) strlcpy(seq_run.error, "aborted", sizeof(seq_run.error));
+        }
+        seq_run.end_ms = millis();
+        seq_run.runs++;
+        seq_run.active = false;
+    }
+}
+#endif
+
+/**
+ * @brief Start a sequence run
+ * @return False if a run is active, the plan has no host, or unsupported
+ */
+bool requestSequence(const SeqPlan& plan, bool sweep = false) {
+#ifdef ESP32
+    if (!seq_task || seq_run.active || plan.host[0] == '\0') return false;
+    uint32_t runs = seq_run.runs;
+    seq_run = {};
+    seq_run.runs = runs;
+    seq_run.plan = plan;
+    seq_run.sweep = sweep;
+    seq_run.start_ms = millis();
+    seq_run.active = true;
+    xTaskNotifyGive(seq_task);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Position in the report while it is streamed out
+ */
+struct SeqCursor {
+    int part;
+    int level;
+    int metric;     // -1 before the level header
+    bool first;     // No metric written yet in this level
+};
+
+// Every fragment must fit HTTP_CHUNK_MIN: the strings get a fragment each,
+// sized from their field, and metric values are clamped to
+// SEQ_REPORT_VALUE_CHARS characters.
+static_assert(sizeof(SeqPlan::host) + 12 < HTTP_CHUNK_MIN, "host fragment exceeds HTTP_CHUNK_MIN");
+static_assert(sizeof(SeqPlan::path) + 12 < HTTP_CHUNK_MIN, "path fragment exceeds HTTP_CHUNK_MIN");
+static_assert(sizeof(SeqRun::error) + 48 < HTTP_CHUNK_MIN, "error fragment exceeds HTTP_CHUNK_MIN");
+const float SEQ_REPORT_VALUE_MAX = 1e9f;
+const size_t SEQ_REPORT_VALUE_CHARS = sizeof("-1000000000.000") - 1; // %.3f of -SEQ_REPORT_VALUE_MAX
+static_assert(sizeof(",\"udp_jitter_ms\":{\"n\":4294967295,\"min\":,\"mean\":,\"max\":,\"stddev\":}")
+              + 4 * SEQ_REPORT_VALUE_CHARS < HTTP_CHUNK_MIN, "metric fragment exceeds HTTP_CHUNK_MIN");
+
+/**
+ * @brief Clamp a metric value so its %.3f form stays within SEQ_REPORT_VALUE_CHARS
+ */
+float seqReportValue(float v) {
+    return constrain(v, -SEQ_REPORT_VALUE_MAX, SEQ_REPORT_VALUE_MAX);
+}
+
+int seqReportFragment(SeqCursor& c, char* out, size_t cap);
+
+/**
+ * @brief Next fragment of the JSON report; 0 at the end
+ * Fragments stay below HTTP_CHUNK_MIN, so the same generator feeds
+ * sendChunks() and the serial console. A fragment that would not fit
+ * ends the report rather than emitting a cut-off one.
+ */
+int seqReportNext(SeqCursor& c, char* out, size_t cap) {
+    int n = seqReportFragment(c, out, cap);
+    if (n >= (int)cap) {
+        Serial.println("Sequencer: report fragment too long");
+        return 0;
+    }
+    return n;
+}
+
+int seqReportFragment(SeqCursor& c, char* out, size_t cap) {
+    const SeqRun& r = seq_run;
+    const SeqPlan& p = r.plan;
+    char tests[32];
+    switch (c.part) {
+        case 0:
+            c.part++;
+            return snprintf(out, cap, "{\"supported\":%s,\"active\":%s,\"sweep\":%s,\"runs\":%u,\"level\":%u,\"iteration\":%u,",
+#ifdef ESP32
+                            "true",
+#else
+                            "false",
+#endif
+                            r.active ? "true" : "false", r.sweep ? "true" : "false", (unsigned)r.runs, r.level, r.iteration);
+        case 1:
+            c.part++;
+            return snprintf(out, cap, "\"elapsed_ms\":%u,\"error\":\"%s\",\"plan\":{",
+                            (unsigned)(r.start_ms ? (r.active ? millis() : r.end_ms) - r.start_ms : 0), r.error);
+        case 2:
+            c.part++;
+            return snprintf(out, cap, "\"host\":\"%s\",", p.host);
+        case 3:
+            c.part++;
+            return snprintf(out, cap, "\"path\":\"%s\",", p.path);
+        case 4:
+            c.part++;
+            seqFormatTests(tests, sizeof(tests), p.tests);
+            return snprintf(out, cap, "\"port\":%u,\"http_port\":%u,\"tests\":\"%s\",", p.port, p.http_port, tests);
+        case 5:
+            c.part++;
+            c.level = 0;
+            c.metric = -1;
+            return snprintf(out, cap, "\"iterations\":%u,\"streams\":%u,\"duration_ms\":%u,\"udp_rate_kbps\":%u},\"levels\":[",
+                            p.iterations, p.streams, (unsigned)p.duration_ms, (unsigned)p.udp_rate_kbps);
+        case 6:
+            while (c.level < p.power_count && c.level < SEQ_MAX_POWERS) {
+                const SeqLevel& l = r.levels[c.level];
+                if (c.metric < 0) {
+                    c.metric = 0;
+                    c.first = true;
+                    return snprintf(out, cap, "%s{\"tx_power_dbm\":%.2f,\"failures\":%u,\"retransmits\":%u,\"disconnects\":%u,\"metrics\":{",
+                                    c.level > 0 ? "," : "", p.powers[c.level], l.failures, (unsigned)l.retransmits,
+                                    (unsigned)l.disconnects);
+                }
+                while (c.metric < SEQ_METRIC_COUNT && !(p.tests & SEQ_METRIC_TEST[c.metric])) c.metric++;
+                if (c.metric < SEQ_METRIC_COUNT) {
+                    const SeqStat& s = l.metrics[c.metric];
+                    int n = snprintf(out, cap, "%s\"%s\":{\"n\":%u,\"min\":%.3f,\"mean\":%.3f,\"max\":%.3f,\"stddev\":%.3f}",
+                                     c.first ? "" : ",", SEQ_METRIC_NAMES[c.metric], s.n,
+                                     seqReportValue(s.n ? s.min : 0.0f), seqReportValue(s.mean),
+                                     seqReportValue(s.n ? s.max : 0.0f), seqReportValue(seqStddev(s)));
+                    c.first = false;
+                    c.metric++;
+                    return n;
+                }
+                c.level++;
+                c.metric = -1;
+                return snprintf(out, cap, "}}");
+            }
+            c.part++;
+            return snprintf(out, cap, "]}\n");
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Print the report on the serial console
+ */
+void seqPrintReport() {
+    SeqCursor cursor = { 0, 0, -1, true };
+    char line[HTTP_CHUNK_MIN];
+    int n;
+    while ((n = seqReportNext(cursor, line, sizeof(line))) > 0) {
+        Serial.write((const uint8_t*)line, n);
+    }
+}
+
+/**
+ * @brief Handle one console line: a key=value setting or a command
+ */
+void seqConsoleLine(char* line) {
+    while (*line == ' ') line++;
+    size_t len = strlen(line);
+    while (len > 0 && line[len - 1] == ' ') line[--len] = '\0';
+    if (len == 0) return;
+
+    char* eq = strchr(line, '=');
+    if (eq) {
+        *eq = '\0';
+        if (!seqPlanSet(seq_plan, line, eq + 1)) Serial.printf("seq: invalid %s\n", line);
+    } else if (strcmp(line, "run") == 0) {
+        seq_serial_report = requestSequence(seq_plan);
+        Serial.println(seq_serial_report ? "seq: started" : "seq: busy, no host, or unsupported");
+    } else if (strcmp(line, "abort") == 0) {
+        seq_run.abort = true;
+    } else if (strcmp(line, "report") == 0) {
+        seqPrintReport();
+    } else if (strcmp(line, "reset") == 0) {
+        seqDefaultPlan(seq_plan);
+    } else {
+        Serial.println("seq: key=value, run, abort, report or reset");
+    }
+}
+
+/**
+ * @brief Read console input and print the report of a finished run
+ */
+void seqSerialService() {
+    static char line[160];
+    static size_t len = 0;
+    while (Serial.available() > 0) {
+        int c = Serial.read();
+        if (c == '\r') continue;
+        if (c == '\n' || c == ';') {
+            line[len] = '\0';
+            seqConsoleLine(line);
+            len = 0;
+        } else if (len < sizeof(line) - 1) {
+            line[len++] = c;
+        }
+    }
+    if (seq_serial_report && !seq_run.active) {
+        seq_serial_report = false;
+        seqPrintReport();
+    }
+}
+
+/**
+ * @brief Set the console plan defaults and create the sequencer task
+ */
+void startSequencer() {
+    seqDefaultPlan(seq_plan);
+#ifdef ESP32
+    startTask(seqTask, "sequencer", 6144, TRAFFIC_TASK_PRIORITY, TRAFFIC_CORE, &seq_task);
+#endif
+}
+#endif
+
+// -------------------------------------------------------------------------
+// Latency Engine (WebSocket / UDP echo)
+// -------------------------------------------------------------------------
+// Measures round-trip time without HTTP request parsing or TCP setup in the
+// loop. The dashboard opens one WebSocket on LATENCY_WS_PORT and sends
+//   start <count> <interval_ms> [size]
+// The device then sends <count> binary probes on its own schedule, stamped
+// with esp_timer_get_time(). The browser echoes each one back unchanged,
+// and the device times the RTT in microseconds on its own clock. After the
+// last probe (plus LATENCY_TIMEOUT_MS for stragglers) a JSON report with
+// min/avg/max, p50/p95/p99, jitter and loss is sent as a text frame. It is
+// also kept for /api/latency.
+//
+// LATENCY_UDP_PORT is a plain RFC 862 echo for external tools, e.g.
+//   nping --udp -p 7 -c 100 --delay 20ms 192.168.4.1
+// Both sockets are served by one FreeRTOS task (ESP32), with TCP_NODELAY on
+// the WebSocket so probes are never held back by Nagle.
+
+const uint16_t LATENCY_WS_PORT = 81;
+const uint16_t LATENCY_UDP_PORT = 7;
+const int LATENCY_MAX_PROBES = 1000;
+const int LATENCY_MAX_PAYLOAD = 512;
+const uint32_t LATENCY_TIMEOUT_MS = 1000;   // Wait for late echoes after the last probe
+
+/**
+ * @brief Result of the current (or last finished) WebSocket latency run
+ */
+struct LatencyReport {
+    bool     active;        // Probes in flight
+    uint32_t runs;          // Completed runs since boot
+    uint16_t count;         // Probes requested
+    uint16_t interval_ms;   // Probe spacing
+    uint16_t size;          // Probe payload bytes
+    uint16_t received;      // Probes echoed back in time
+    uint32_t min_us, avg_us, max_us;
+    uint32_t p50_us, p95_us, p99_us;
+    uint32_t jitter_us;     // RFC 3550 style, over consecutive RTTs
+};
+LatencyReport latency_report = {};
+volatile uint32_t latency_udp_echoes = 0;
+
+/**
+ * @brief Serialize a latency report (shared by /api/latency and the WebSocket)
+ */
+void writeLatencyReport(JsonWriter& w, const LatencyReport& r) {
+    uint16_t lost = r.count - r.received;
+    w.beginObject();
+    w.field("active", r.active);
+    w.field("runs", r.runs);
+    w.field("count", r.count);
+    w.field("interval_ms", r.interval_ms);
+    w.field("size", r.size);
+    w.field("received", r.received);
+    w.field("lost", lost);
+    w.field("loss_pct", r.count > 0 ? lost * 100.0 / r.count : 0.0, 1);
+    w.field("min_us", r.min_us);
+    w.field("avg_us", r.avg_us);
+    w.field("max_us", r.max_us);
+    w.field("p50_us", r.p50_us);
+    w.field("p95_us", r.p95_us);
+    w.field("p99_us", r.p99_us);
+    w.field("jitter_us", r.jitter_us);
+    w.endObject();
+}
+
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+const uint32_t LATENCY_NO_ECHO = 0xFFFFFFFF;
+const char* WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/**
+ * @brief Probe schedule and raw samples of the run in progress
+ */
+struct LatencyRun {
+    int64_t  sent_us[LATENCY_MAX_PROBES];
+    uint32_t rtt_us[LATENCY_MAX_PROBES];    // LATENCY_NO_ECHO until echoed
+    uint16_t sent;
+    int64_t  next_us;                       // Due time of the next probe
+};
+static LatencyRun latency_run;
+
+/**
+ * @brief recv() exactly len bytes; the socket has a receive timeout set
+ */
+bool wsRecvAll(int fd, uint8_t* buf, size_t len) {
+    while (len > 0) {
+        int n = recv(fd, buf, len, 0);
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief Send one unmasked server frame (payloads below 64 KB)
+ */
+bool wsSendFrame(int fd, uint8_t opcode, const uint8_t* data, size_t len) {
+    uint8_t hdr[4];
+    size_t hdrLen = 2;
+    hdr[0] = 0x80 | opcode;
+    if (len < 126) {
+        hdr[1] = len;
+    } else {
+        hdr[1] = 126;
+        hdr[2] = len >> 8;
+        hdr[3] = len & 0xFF;
+        hdrLen = 4;
+    }
+    return ::send(fd, hdr, hdrLen, 0) == (int)hdrLen &&
+           (len == 0 || ::send(fd, data, len, 0) == (int)len);
+}
+
+/**
+ * @brief Answer the HTTP upgrade request; false if it is not a WebSocket
+ */
+bool wsHandshake(int fd) {
+    char req[768];
+    size_t used = 0;
+    while (used < sizeof(req) - 1) {
+        int n = recv(fd, req + used, sizeof(req) - 1 - used, 0);
+        if (n <= 0) return false;
+        used += n;
+        req[used] = '\0';
+        if (strstr(req, "\r\n\r\n")) break;
+    }
+
+    const char* key = strcasestr(req, "Sec-WebSocket-Key:");
+    if (!key) return false;
+    key += strlen("Sec-WebSocket-Key:");
+    while (*key == ' ') key++;
+    const char* end = strstr(key, "\r\n");
+    if (!end || end - key > 32) return false;
+
+    char concat[80];
+    snprintf(concat, sizeof(concat), "%.*s%s", (int)(end - key), key, WS_GUID);
+    uint8_t digest[20];
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+    mbedtls_sha1((const uint8_t*)concat, strlen(concat), digest);
+#else
+    mbedtls_sha1_ret((const uint8_t*)concat, strlen(concat), digest);
+#endif
+    uint8_t accept[32];
+    size_t acceptLen = 0;
+    mbedtls_base64_encode(accept, sizeof(accept), &acceptLen, digest, sizeof(digest));
+
+    char resp[160];
+    int n = snprintf(resp, sizeof(resp),
+                     "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: %.*s\r\n\r\n",
+                     (int)acceptLen, (const char*)accept);
+    return ::send(fd, resp, n, 0) == n;
+}
+
+/**
+ * @brief Reduce the raw samples of the finished run into latency_report
+ */
+void latencyFinish() {
+    LatencyReport& r = latency_report;
+    uint32_t* rtt = latency_run.rtt_us;
+    uint64_t sum = 0;
+    float jitter = 0;
+    uint32_t prev = LATENCY_NO_ECHO;
+    r.received = 0;
+    for (int i = 0; i < r.count; i++) {
+        if (rtt[i] == LATENCY_NO_ECHO) continue;
+        r.received++;
+        sum += rtt[i];
+        if (prev != LATENCY_NO_ECHO) {
+            int32_t d = (int32_t)rtt[i] - (int32_t)prev;
+            if (d < 0) d = -d;
+            jitter += (d - jitter) / 16.0f;
+        }
+        prev = rtt[i];
+    }
+
+    // Lost probes sort to the end; percentiles index the echoed prefix only
+    std::sort(rtt, rtt + r.count);
+    uint16_t n = r.received;
+    r.min_us = n ? rtt[0] : 0;
+    r.max_us = n ? rtt[n - 1] : 0;
+    r.avg_us = n ? sum / n : 0;
+    r.p50_us = n ? rtt[(n - 1) * 50 / 100] : 0;
+    r.p95_us = n ? rtt[(n - 1) * 95 / 100] : 0;
+    r.p99_us = n ? rtt[(n - 1) * 99 / 100] : 0;
+    r.jitter_us = (uint32_t)jitter;
+    r.active = false;
+    r.runs++;
+    resultsLog(RESULT_LATENCY, r.count, r.received, r.avg_us / 1000.0f, r.p99_us / 1000.0f, r.jitter_us / 1000.0f);
+}
+
+/**
+ * @brief Handle one client frame; false when the connection should close
+ */
+bool wsHandleFrame(int fd) {
+    static uint8_t payload[LATENCY_MAX_PAYLOAD];
+    uint8_t hdr[2];
+    if (!wsRecvAll(fd, hdr, 2)) return false;
+    int64_t nowUs = esp_timer_get_time();
+
+    uint8_t opcode = hdr[0] & 0x0F;
+    size_t len = hdr[1] & 0x7F;
+    if (len == 126) {
+        uint8_t ext[2];
+        if (!wsRecvAll(fd, ext, 2)) return false;
+        len = (ext[0] << 8) | ext[1];
+    } else if (len == 127 || !(hdr[1] & 0x80)) {
+        return false; // Oversized, or an unmasked client frame
+    }
+    if (len > sizeof(payload)) return false;
+    uint8_t mask[4];
+    if (!wsRecvAll(fd, mask, 4) || !wsRecvAll(fd, payload, len)) return false;
+    for (size_t i = 0; i < len; i++) payload[i] ^= mask[i & 3];
+
+    switch (opcode) {
+    case 0x2: { // Probe echo: seq (uint32, little endian) first
+        LatencyReport& r = latency_report;
+        if (!r.active || len < 4) break;
+        uint32_t seq;
+        memcpy(&seq, payload, sizeof(seq));
+        if (seq < latency_run.sent && latency_run.rtt_us[seq] == LATENCY_NO_ECHO) {
+            latency_run.rtt_us[seq] = (uint32_t)(nowUs - latency_run.sent_us[seq]);
+        }
+        break;
+    }
+    case 0x1: { // Command
+        payload[len < sizeof(payload) ? len : sizeof(payload) - 1] = '\0';
+        unsigned count = 0, interval = 0, size = 16;
+        if (sscanf((const char*)payload, "start %u %u %u", &count, &interval, &size) >= 2) {
+            LatencyReport& r = latency_report;
+            uint32_t runs = r.runs;
+            r = {};
+            r.runs = runs;
+            r.count = constrain(count, 1u, (unsigned)LATENCY_MAX_PROBES);
+            r.interval_ms = constrain(interval, 1u, 10000u);
+            r.size = constrain(size, 12u, (unsigned)LATENCY_MAX_PAYLOAD);
+            r.active = true;
+            netstatsMark("latency");
+            for (int i = 0; i < r.count; i++) latency_run.rtt_us[i] = LATENCY_NO_ECHO;
+            latency_run.sent = 0;
+            latency_run.next_us = nowUs;
+        }
+        break;
+    }
+    case 0x8: // Close
+        wsSendFrame(fd, 0x8, payload, len < 2 ? len : 2);
+        return false;
+    case 0x9: // Ping
+        wsSendFrame(fd, 0xA, payload, len);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief Send the next probe if due, or close the run after the timeout
+ */
+bool latencyTick(int fd) {
+    static uint8_t probe[LATENCY_MAX_PAYLOAD];
+    LatencyReport& r = latency_report;
+    if (!r.active) return true;
+
+    int64_t nowUs = esp_timer_get_time();
+    if (latency_run.sent < r.count) {
+        if (nowUs < latency_run.next_us) return true;
+        uint32_t seq = latency_run.sent;
+        memset(probe, 0x55, r.size);
+        memcpy(probe, &seq, sizeof(seq));
+        memcpy(probe + 4, &nowUs, sizeof(nowUs));
+        latency_run.sent_us[seq] = nowUs;
+        latency_run.sent++;
+        latency_run.next_us += (int64_t)r.interval_ms * 1000;
+        return wsSendFrame(fd, 0x2, probe, r.size);
+    }
+
+    bool allEchoed = true;
+    for (int i = 0; i < r.count && allEchoed; i++) allEchoed = latency_run.rtt_us[i] != LATENCY_NO_ECHO;
+    int64_t lastSent = latency_run.sent_us[r.count - 1];
+    if (!allEchoed && nowUs - lastSent < (int64_t)LATENCY_TIMEOUT_MS * 1000) return true;
+
+    latencyFinish();
+    static char report[512];
+    JsonWriter w(report, sizeof(report));
+    writeLatencyReport(w, r);
+    return wsSendFrame(fd, 0x1, (const uint8_t*)report, strlen(report));
+}
+
+/**
+ * @brief Bind a socket of the given type to port on all interfaces
+ */
+int latencyBind(int type, uint16_t port) {
+    int fd = socket(AF_INET, type, type == SOCK_STREAM ? IPPROTO_TCP : IPPROTO_UDP);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || (type == SOCK_STREAM && listen(fd, 1) != 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Serves the UDP echo port and one WebSocket latency client
+ */
+void latencyTask(void* arg) {
+    static uint8_t echo[1472];
+    int listenFd = latencyBind(SOCK_STREAM, LATENCY_WS_PORT);
+    int udpFd = latencyBind(SOCK_DGRAM, LATENCY_UDP_PORT);
+    if (listenFd < 0 || udpFd < 0) {
+        Serial.println("Latency engine: bind/listen failed");
+        if (listenFd >= 0) close(listenFd);
+        if (udpFd >= 0) close(udpFd);
+        taskExit();
+        return;
+    }
+    int wsFd = -1;
+
+    for (;;) {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(listenFd, &readSet);
+        FD_SET(udpFd, &readSet);
+        int maxFd = listenFd > udpFd ? listenFd : udpFd;
+        if (wsFd >= 0) {
+            FD_SET(wsFd, &readSet);
+            if (wsFd > maxFd) maxFd = wsFd;
+        }
+
+        // Sleep until the next probe is due while a run is active
+        timeval tv = { 0, 0 };
+        timeval* timeout = NULL;
+        if (wsFd >= 0 && latency_report.active) {
+            int64_t wait = latency_run.next_us - esp_timer_get_time();
+            if (latency_run.sent >= latency_report.count) wait = 10000;
+            if (wait > 0) tv.tv_usec = wait < 1000000 ? wait : 999999;
+            timeout = &tv;
+        }
+        int ready = select(maxFd + 1, &readSet, NULL, NULL, timeout);
+
+        if (ready > 0 && FD_ISSET(udpFd, &readSet)) {
+            sockaddr_in peer;
+            socklen_t peerLen = sizeof(peer);
+            int n = recvfrom(udpFd, echo, sizeof(echo), 0, (sockaddr*)&peer, &peerLen);
+            if (n > 0) {
+                sendto(udpFd, echo, n, 0, (sockaddr*)&peer, peerLen);
+                latency_udp_echoes++;
+            }
+        }
+
+        if (ready > 0 && FD_ISSET(listenFd, &readSet)) {
+            int fd = accept(listenFd, NULL, NULL);
+            if (fd >= 0) {
+                // A new client replaces the previous one and aborts its run
+                if (wsFd >= 0) close(wsFd);
+                latency_report.active = false;
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                timeval rcvTimeout = { 1, 0 };
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rcvTimeout, sizeof(rcvTimeout));
+                wsFd = fd;
+                if (!wsHandshake(wsFd)) {
+                    close(wsFd);
+                    wsFd = -1;
+                }
+                continue;
+            }
+        }
+
+        if (wsFd < 0) continue;
+        bool open = true;
+        if (ready > 0 && FD_ISSET(wsFd, &readSet)) open = wsHandleFrame(wsFd);
+        if (open) open = latencyTick(wsFd);
+        if (!open) {
+            close(wsFd);
+            wsFd = -1;
+            latency_report.active = false;
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Start the WebSocket latency engine and the UDP echo port
+ */
+void startLatencyEngine() {
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+    // One above the sinks so probes are not queued behind a bulk transfer
+    startTask(latencyTask, "latency", 4096, TRAFFIC_TASK_PRIORITY + 1, TRAFFIC_CORE);
+    Serial.printf("Latency engine on WebSocket %u, UDP echo %u\n", LATENCY_WS_PORT, LATENCY_UDP_PORT);
+#endif
+}
+
+#if FEATURE_SCANNER
+// -------------------------------------------------------------------------
+// Background WiFi Scanner
+// -------------------------------------------------------------------------
+// /api/scan never scans inline. Results live in a timestamped cache that a
+// background scan refreshes on request. On dual-core chips the blocking scan
+// runs in its own task on the protocol core; single-core chips (C3, ESP8266)
+// start the driver's asynchronous scan and collect the results from loop().
+
+const int SCAN_CACHE_MAX = 32;
+
+/**
+ * @brief One network from the last completed scan
+ */
+struct ScanEntry {
+    char    ssid[33];
+    int8_t  rssi;
+    uint8_t channel;
+    uint8_t auth;       // Raw encryption type, see translateEncryptionType()
+};
+
+/**
+ * @brief Results of the last completed scan plus scanner state
+ */
+struct ScanCache {
+    ScanEntry entries[SCAN_CACHE_MAX];
+    uint8_t   count;
+    uint32_t  updated_ms;       // millis() at completion, valid if scans > 0
+    uint32_t  scans;            // Completed scans since boot
+    volatile bool scanning;     // A scan is in progress
+};
+ScanCache scan_cache = {};
+
+#ifdef ESP32
+SemaphoreHandle_t scan_mutex = NULL;
+TaskHandle_t scan_task = NULL;
+#define SCAN_LOCK()   xSemaphoreTake(scan_mutex, portMAX_DELAY)
+#define SCAN_UNLOCK() xSemaphoreGive(scan_mutex)
+#else
+#define SCAN_LOCK()
+#define SCAN_UNLOCK()
+#endif
+
+/**
+ * @brief Copy n finished scan results from the driver into the cache
+ */
+void scanStoreResults(int n) {
+    if (n < 0) n = 0;
+    if (n > SCAN_CACHE_MAX) n = SCAN_CACHE_MAX;
+
+    SCAN_LOCK();
+    for (int i = 0; i < n; i++) {
+        ScanEntry& e = scan_cache.entries[i];
+        strncpy(e.ssid, WiFi.SSID(i).c_str(), sizeof(e.ssid) - 1);
+        e.ssid[sizeof(e.ssid) - 1] = '\0';
+        e.rssi = WiFi.RSSI(i);
+        e.channel = WiFi.channel(i);
+        e.auth = WiFi.encryptionType(i);
+    }
+    scan_cache.count = n;
+    scan_cache.updated_ms = millis();
+    scan_cache.scans++;
+    scan_cache.scanning = false;
+    SCAN_UNLOCK();
+
+    WiFi.scanDelete(); // Clean up RAM
+}
+
+#ifdef ESP32
+/**
+ * @brief Dual-core scanner task: performs a blocking scan per notification
+ */
+void scanTask(void* arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        scanStoreResults(WiFi.scanNetworks(false, true));
+    }
+}
+#endif
+
+/**
+ * @brief Start a background scan unless one is already running
+ */
+void requestScan() {
+    // Check and claim under the lock; the analyzer claims the same flag
+    SCAN_LOCK();
+    bool busy = scan_cache.scanning;
+    scan_cache.scanning = true;
+    SCAN_UNLOCK();
+    if (busy) return;
+#ifdef ESP32
+    if (scan_task) {
+        xTaskNotifyGive(scan_task);
+        return;
+    }
+#endif
+    if (WiFi.scanNetworks(true) == WIFI_SCAN_FAILED) {
+        scan_cache.scanning = false;
+    }
+}
+
+/**
+ * @brief Collect async scan results on single-core chips; call from loop()
+ */
+void scanService() {
+#ifdef ESP32
+    if (scan_task) return;
+#endif
+    if (!scan_cache.scanning) return;
+    int n = WiFi.scanComplete();
+    if (n >= 0) {
+        scanStoreResults(n);
+    } else if (n == WIFI_SCAN_FAILED) {
+        scan_cache.scanning = false;
+    }
+}
+
+/**
+ * @brief Set up the scanner; setup() warms the cache once the AP is up
+ */
+void startScanner() {
+#ifdef ESP32
+    scan_mutex = xSemaphoreCreateMutex();
+    if (ESP.getChipCores() > 1) {
+        // Beside the WiFi driver, below HTTP
+        startTask(scanTask, "wifi_scan", 4096, tskIDLE_PRIORITY + 1, CONTROL_CORE, &scan_task);
+    }
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Channel Analyzer (promiscuous capture)
+// -------------------------------------------------------------------------
+// A scan lists the networks it can hear, but not how much airtime they use.
+// The analyzer puts the radio in promiscuous mode and dwells on each channel
+// in turn. For every frame it hears it counts frames, bytes and retries, and
+// estimates the airtime from the PHY rate and length in the RX metadata.
+// Busy % is the estimated airtime over the dwell time, and it only counts
+// frames from other stations; the AP's own transmissions are not received.
+// In AP+STA mode the radio has to follow the AP channel, so hopping pauses
+// the AP for channels x dwell_ms (about 2 s by default), like a scan does.
+// hop=0 listens on the AP channel only and does not disturb clients.
+//
+// The driver calls the capture callback from the WiFi task, which is the
+// only writer of the counters. The analyzer task reads them only after
+// capture is off, so the counters need no lock (ESP32 only).
+
+const int AIRTIME_MAX_CHANNELS = 14;
+const int AIRTIME_MAX_TALKERS = 32;        // Transmitters tracked per run
+const int AIRTIME_REPORT_TALKERS = 6;      // Top talkers reported
+const uint32_t AIRTIME_DEFAULT_DWELL_MS = 150;
+
+/**
+ * @brief Counters for one channel over its dwell
+ */
+struct AirtimeChannel {
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t retries;       // Frames with the retry bit set
+    uint32_t mgmt, ctrl, data;
+    uint32_t airtime_us;    // Estimated time on air
+    uint32_t dwell_us;      // Time spent listening
+    int8_t   rssi_max;
+};
+
+/**
+ * @brief One transmitter heard during the run
+ */
+struct AirtimeTalker {
+    uint8_t  mac[6];
+    uint8_t  channel;
+    int8_t   rssi;          // Last frame
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t retries;
+    uint32_t airtime_us;
+};
+
+/**
+ * @brief Results of the current (or last finished) analyzer run
+ */
+struct AirtimeReport {
+    volatile bool running;
+    bool     hop;
+    uint8_t  first, count;  // Channels first .. first + count - 1
+    uint8_t  ap_channel;
+    uint32_t dwell_ms;
+    uint32_t runs;          // Completed runs since boot
+    uint32_t finished_ms;   // millis() at completion, valid if runs > 0
+    uint32_t untracked;     // Frames from transmitters beyond the talker table
+    uint8_t  talker_count;
+    AirtimeChannel channels[AIRTIME_MAX_CHANNELS];
+    AirtimeTalker  talkers[AIRTIME_MAX_TALKERS];
+};
+AirtimeReport airtime = {};
+
+#ifdef ESP32
+TaskHandle_t airtime_task = NULL;
+volatile uint8_t airtime_channel = 0;   // Channel being captured, 0: capture off
+
+/**
+ * @brief Non-HT rate codes (wifi_phy_rate_t) in units of 0.5 Mbps
+ */
+const uint8_t AIRTIME_LEGACY_RATE[16] = {
+    2, 4, 11, 22, 0, 4, 11, 22,         // DSSS/CCK long, short preamble
+    96, 48, 24, 12, 108, 72, 36, 18     // OFDM
+};
+
+/**
+ * @brief HT20 MCS 0-7 rates, long guard interval, in units of 0.5 Mbps
+ */
+const uint8_t AIRTIME_HT_RATE[8] = { 13, 26, 39, 52, 78, 104, 117, 130 };
+
+/**
+ * @brief Estimate the time on air of one received frame, preamble included
+ */
+uint32_t airtimeFrameUs(const wifi_pkt_rx_ctrl_t& rx) {
+    uint32_t halfMbps;
+    uint32_t preambleUs;
+    if (rx.sig_mode == 0) {
+        halfMbps = AIRTIME_LEGACY_RATE[rx.rate & 0x0F];
+        preambleUs = rx.rate < 4 ? 192 : rx.rate < 8 ? 96 : 20;
+    } else {
+        halfMbps = AIRTIME_HT_RATE[rx.mcs & 0x07] * ((rx.mcs >> 3) + 1);
+        if (rx.cwb) halfMbps = halfMbps * 27 / 13;
+        if (rx.sgi) halfMbps = halfMbps * 10 / 9;
+        preambleUs = 36;
+    }
+    if (halfMbps == 0) halfMbps = 2;
+    return preambleUs + rx.sig_len * 16 / halfMbps; // bits / Mbps
+}
+
+/**
+ * @brief Find or add the talker entry for mac; NULL when the table is full
+ * Only called from the capture callback.
+ */
+AirtimeTalker* airtimeTalker(const uint8_t* mac, uint8_t channel) {
+    for (int i = 0; i < airtime.talker_count; i++) {
+        AirtimeTalker& t = airtime.talkers[i];
+        if (t.channel == channel && memcmp(t.mac, mac, 6) == 0) return &t;
+    }
+    if (airtime.talker_count >= AIRTIME_MAX_TALKERS) return NULL;
+    AirtimeTalker& t = airtime.talkers[airtime.talker_count++];
+    memcpy(t.mac, mac, 6);
+    t.channel = channel;
+    return &t;
+}
+
+/**
+ * @brief Promiscuous RX callback, runs in the WiFi task
+ */
+void airtimeCapture(void* buf, wifi_promiscuous_pkt_type_t type) {
+    uint8_t ch = airtime_channel;
+    if (ch == 0 || type == WIFI_PKT_MISC) return;
+    const wifi_promiscuous_pkt_t* pkt = (const wifi_promiscuous_pkt_t*)buf;
+    const uint8_t* frame = pkt->payload;
+    uint32_t len = pkt->rx_ctrl.sig_len;
+    uint32_t us = airtimeFrameUs(pkt->rx_ctrl);
+    bool retry = len >= 2 && (frame[1] & 0x08);
+
+    AirtimeChannel& c = airtime.channels[ch - airtime.first];
+    c.frames++;
+    c.bytes += len;
+    c.airtime_us += us;
+    if (retry) c.retries++;
+    if (type == WIFI_PKT_MGMT) c.mgmt++;
+    else if (type == WIFI_PKT_CTRL) c.ctrl++;
+    else c.data++;
+    if (c.frames == 1 || pkt->rx_ctrl.rssi > c.rssi_max) c.rssi_max = pkt->rx_ctrl.rssi;
+
+    // Management and data frames carry the transmitter in addr2
+    if (type == WIFI_PKT_CTRL || len < 16) return;
+    AirtimeTalker* t = airtimeTalker(frame + 10, ch);
+    if (!t) {
+        airtime.untracked++;
+        return;
+    }
+    t->frames++;
+    t->bytes += len;
+    t->airtime_us += us;
+    t->rssi = pkt->rx_ctrl.rssi;
+    if (retry) t->retries++;
+}
+
+/**
+ * @brief Analyzer task: one run per notification
+ */
+void airtimeTask(void* arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        wifi_promiscuous_filter_t filter = {
+            WIFI_PROMIS_FILTER_MASK_MGMT | WIFI_PROMIS_FILTER_MASK_CTRL | WIFI_PROMIS_FILTER_MASK_DATA
+        };
+        wifi_promiscuous_filter_t ctrl = { WIFI_PROMIS_CTRL_FILTER_MASK_ALL };
+        esp_wifi_set_promiscuous_filter(&filter);
+        esp_wifi_set_promiscuous_ctrl_filter(&ctrl);
+        esp_wifi_set_promiscuous_rx_cb(airtimeCapture);
+        esp_wifi_set_promiscuous(true);
+
+        for (int i = 0; i < airtime.count; i++) {
+            uint8_t ch = airtime.first + i;
+            if (airtime.hop) esp_wifi_set_channel(ch, WIFI_SECOND_CHAN_NONE);
+            int64_t start = esp_timer_get_time();
+            airtime_channel = ch;
+            vTaskDelay(pdMS_TO_TICKS(airtime.dwell_ms));
+            airtime_channel = 0;
+            airtime.channels[i].dwell_us = esp_timer_get_time() - start;
+        }
+
+        esp_wifi_set_promiscuous(false);
+        if (airtime.hop) esp_wifi_set_channel(airtime.ap_channel, WIFI_SECOND_CHAN_NONE);
+
+        airtime.finished_ms = millis();
+        airtime.runs++;
+        airtime.running = false;
+        scan_cache.scanning = false;
+    }
+}
+#endif
+
+/**
+ * @brief Channels allowed by the configured country, at most AIRTIME_MAX_CHANNELS
+ */
+void wifiChannelRange(uint8_t& first, uint8_t& count) {
+    wifi_country_t country = {};
+#ifdef ESP32
+    esp_wifi_get_country(&country);
+#else
+    wifi_get_country(&country);
+#endif
+    first = country.schan ? country.schan : 1;
+    count = country.nchan ? country.nchan : 13;
+    if (count > AIRTIME_MAX_CHANNELS) count = AIRTIME_MAX_CHANNELS;
+}
+
+/**
+ * @brief True when the analyzer task is running on this board
+ */
+bool airtimeAvailable() {
+#ifdef ESP32
+    return airtime_task != NULL;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Start an analyzer run unless the radio is busy
+ * @param hop False listens on the AP channel only
+ * @return False if a scan or analyzer run is in progress, or unsupported
+ */
+bool requestAirtime(bool hop, uint32_t dwellMs) {
+#ifdef ESP32
+    if (!airtimeAvailable() || airtime.running) return false;
+    // Hopping would drop the link to an upstream AP
+    if (hop && WiFi.status() == WL_CONNECTED) return false;
+    // Marking the scanner busy keeps the two from hopping the radio at once
+    SCAN_LOCK();
+    bool busy = scan_cache.scanning;
+    scan_cache.scanning = true;
+    SCAN_UNLOCK();
+    if (busy) return false;
+
+    uint8_t apChannel = WiFi.channel();
+    uint8_t first, count;
+    wifiChannelRange(first, count);
+
+    airtime = {};
+    airtime.running = true;
+    airtime.hop = hop;
+    airtime.first = hop ? first : apChannel;
+    airtime.count = hop ? count : 1;
+    airtime.ap_channel = apChannel;
+    airtime.dwell_ms = constrain(dwellMs, 20UL, 1000UL);
+    xTaskNotifyGive(airtime_task);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Busy percentage of a channel in the last run; -1 if not measured
+ */
+int airtimeBusyPct(uint8_t channel) {
+    if (airtime.runs == 0 || airtime.running) return -1;
+    if (channel < airtime.first || channel >= airtime.first + airtime.count) return -1;
+    const AirtimeChannel& c = airtime.channels[channel - airtime.first];
+    if (c.dwell_us == 0) return -1;
+    uint64_t pct = (uint64_t)c.airtime_us * 100 / c.dwell_us;
+    return pct > 100 ? 100 : (int)pct;
+}
+
+/**
+ * @brief Create the analyzer task
+ */
+void startAirtimeAnalyzer() {
+#ifdef ESP32
+    // Mostly sleeps between hops; below HTTP
+    startTask(airtimeTask, "airtime", 3072, tskIDLE_PRIORITY + 1, CONTROL_CORE, &airtime_task);
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Channel Selection
+// -------------------------------------------------------------------------
+// Each channel gets a congestion score from the scan cache. Every network
+// within 4 channels adds its signal strength (rssi + 100, capped at 70),
+// scaled down by how far apart the two 20 MHz channels are. Where the
+// analyzer has measured a channel, its busy % counts CHANNEL_BUSY_WEIGHT
+// points per percent. The lowest score wins. Ties keep the current channel,
+// then prefer 1, 6 and 11.
+//
+// With AP_AUTO_CHANNEL the AP scans (and captures, on ESP32) before it
+// starts, which adds about 4 s to boot. /api/channel re-evaluates at any
+// time and can move the AP; stations then have to reassociate.
+
+const int CHANNEL_BUSY_WEIGHT = 2;
+const uint32_t CHANNEL_MOVE_DELAY_MS = 500;     // Lets the API response go out first
+
+/**
+ * @brief Congestion estimate for one channel
+ */
+struct ChannelScore {
+    uint8_t  channel;
+    uint8_t  networks;      // Networks on this channel
+    uint8_t  overlapping;   // Networks on adjacent, overlapping channels
+    int8_t   busy_pct;      // Analyzer measurement, -1 if none
+    uint16_t score;         // Lower is better
+};
+
+volatile uint8_t channel_pending = 0;   // Move requested, 0: none
+uint32_t channel_pending_ms = 0;
+uint32_t channel_moves = 0;
+
+/**
+ * @brief Score every allowed channel from the scan cache and analyzer
+ * @return Number of entries written to out
+ */
+int channelScores(ChannelScore* out, int max) {
+    uint8_t first, count;
+    wifiChannelRange(first, count);
+    if (count > max) count = max;
+
+    SCAN_LOCK();
+    for (int i = 0; i < count; i++) {
+        ChannelScore& c = out[i];
+        c = {};
+        c.channel = first + i;
+        uint32_t weighted = 0; // x5, for the overlap fraction
+        for (int n = 0; n < scan_cache.count; n++) {
+            const ScanEntry& e = scan_cache.entries[n];
+            int d = abs((int)e.channel - (int)c.channel);
+            if (d > 4) continue;
+            if (d == 0) c.networks++;
+            else c.overlapping++;
+            weighted += constrain(e.rssi + 100, 0, 70) * (5 - d);
+        }
+        c.busy_pct = airtimeBusyPct(c.channel);
+        c.score = weighted / 5 + (c.busy_pct > 0 ? c.busy_pct * CHANNEL_BUSY_WEIGHT : 0);
+    }
+    SCAN_UNLOCK();
+    return count;
+}
+
+/**
+ * @brief Rank used to break ties: current channel, then 1, 6, 11
+ */
+int channelPreference(uint8_t channel, uint8_t current) {
+    if (channel == current) return 0;
+    if (channel == 1 || channel == 6 || channel == 11) return 1;
+    return 2;
+}
+
+/**
+ * @brief Least congested channel, or 0 if nothing has been scanned yet
+ */
+uint8_t channelBest(const ChannelScore* scores, int count, uint8_t current) {
+    if (scan_cache.scans == 0) return 0;
+    const ChannelScore* best = NULL;
+    for (int i = 0; i < count; i++) {
+        const ChannelScore& c = scores[i];
+        if (!best || c.score < best->score ||
+            (c.score == best->score &&
+             channelPreference(c.channel, current) < channelPreference(best->channel, current))) {
+            best = &c;
+        }
+    }
+    return best ? best->channel : 0;
+}
+
+/**
+ * @brief Channel for the AP at boot: AP_CHANNEL, or the best one measured now
+ */
+uint8_t bootChannel() {
+#if AP_AUTO_CHANNEL
+    Serial.print("Choosing AP channel... ");
+    scan_cache.scanning = true;
+    scanStoreResults(WiFi.scanNetworks(false, true));
+
+    // Airtime capture where available; the AP is not up yet, so hop freely
+    if (requestAirtime(true, AIRTIME_DEFAULT_DWELL_MS)) {
+        uint32_t start = millis();
+        while (airtime.running && millis() - start < 5000) delay(50);
+    }
+
+    ChannelScore scores[AIRTIME_MAX_CHANNELS];
+    int count = channelScores(scores, AIRTIME_MAX_CHANNELS);
+    uint8_t best = channelBest(scores, count, AP_CHANNEL);
+    Serial.printf("%u (%u networks seen)\n", best, scan_cache.count);
+    return best ? best : AP_CHANNEL;
+#else
+    return AP_CHANNEL;
+#endif
+}
+
+/**
+ * @brief Restart the AP on a channel requested from /api/channel; call from
+ * loop() or the HTTP task
+ */
+void channelService() {
+    if (!channel_pending || millis() - channel_pending_ms < CHANNEL_MOVE_DELAY_MS) return;
+    uint8_t channel = channel_pending;
+    channel_pending = 0;
+    if (channel == WiFi.channel()) return;
+    Serial.printf("Moving AP to channel %u\n", channel);
+    if (WiFi.softAP(AP_SSID, AP_PASS, channel)) channel_moves++;
+}
+#endif
+
+#if FEATURE_TELEMETRY
+// -------------------------------------------------------------------------
+// Live Telemetry (Server-Sent Events)
+// -------------------------------------------------------------------------
+// /api/events pushes dashboard updates over one long-lived connection instead
+// of a fresh HTTP transaction per poll. A subscriber first receives an
+// "static" event with the fields that never change (chip, flash, SDK), then
+// default "message" events carrying only the live fields that changed since
+// the previous frame, using compact keys:
+//   u uptime s | h free heap | p TX power dBm | x tcp_rexmit | d disconnects
+//   s stations [["MAC", rssi], ...]
+// A new subscriber forces one complete frame so every client starts in sync.
+//
+// The async backend uses AsyncEventSource. The sync backend keeps up to
+// TELEMETRY_MAX_CLIENTS sockets open itself and writes to them
+// non-blocking. A frame the send buffer only partly takes is finished
+// before the next one, and frames are dropped for that client meanwhile.
+
+const int TELEMETRY_MAX_CLIENTS = 4;
+const uint32_t TELEMETRY_MIN_INTERVAL_MS = 100;
+uint32_t telemetry_interval_ms = 500;   // Runtime-tunable via /api/telemetry
+
+/**
+ * @brief Last values broadcast, used to compute deltas
+ */
+struct TelemetryState {
+    bool        valid;          // false forces a full frame
+    uint32_t    uptime;
+    uint32_t    heap;
+    float       tx_power;
+    uint32_t    rexmit;
+    uint32_t    disconnects;
+    int         station_count;
+    StationInfo stations[MAX_STATIONS];
+};
+TelemetryState telemetry_last = {};
+uint32_t telemetry_last_push = 0;
+char telemetry_buf[640];             // Frames built in the HTTP context only
+
+#ifdef HTTP_ASYNC_BACKEND
+AsyncEventSource events("/api/events");
+#elif defined(ESP32)
+WiFiClient telemetry_clients[TELEMETRY_MAX_CLIENTS];
+#endif
+
+/**
+ * @brief Number of connected telemetry subscribers
+ */
+int telemetrySubscribers() {
+#ifdef HTTP_ASYNC_BACKEND
+    return events.count();
+#elif defined(ESP32)
+    int n = 0;
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        if (telemetry_clients[i].connected()) n++;
+    }
+    return n;
+#else
+    return 0;
+#endif
+}
+
+#if !defined(HTTP_ASYNC_BACKEND) && defined(ESP32)
+/**
+ * @brief The frame a subscriber's socket is still taking
+ */
+struct TelemetryBacklog {
+    char     frame[sizeof(telemetry_buf) + 32];  // Room for "event: ..." and framing
+    uint16_t len;
+    uint16_t sent;
+};
+TelemetryBacklog telemetry_backlog[TELEMETRY_MAX_CLIENTS];
+uint32_t telemetry_dropped = 0;     // Frames skipped while a backlog drained
+
+/**
+ * @brief Send as much of a subscriber's backlog as the socket takes, without blocking
+ * @return false if the client is gone and its slot can be reused
+ */
+bool telemetryFlush(int slot) {
+    TelemetryBacklog& b = telemetry_backlog[slot];
+    int fd = telemetry_clients[slot].fd();
+    if (fd < 0) return false;
+    while (b.sent < b.len) {
+        int n = ::send(fd, b.frame + b.sent, b.len - b.sent, MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+        if (n == 0) break;
+        b.sent += n;
+    }
+    return true;
+}
+
+/**
+ * @brief Send one SSE frame to a subscriber, all of it or none of it
+ * A short write leaves the rest in the backlog, and new frames are dropped
+ * until it drains, so a truncated frame never runs into the next one.
+ * @return false if the client is gone and its slot can be reused
+ */
+bool telemetryWrite(int slot, const char* event, const char* data) {
+    if (!telemetryFlush(slot)) return false;
+    TelemetryBacklog& b = telemetry_backlog[slot];
+    if (b.sent < b.len) {
+        telemetry_dropped++;
+        telemetry_last.valid = false; // Deltas were missed; resync with a full frame
+        return true;
+    }
+    int n = event ? snprintf(b.frame, sizeof(b.frame), "event: %s\ndata: %s\n\n", event, data)
+                  : snprintf(b.frame, sizeof(b.frame), "data: %s\n\n", data);
+    b.sent = 0;
+    if (n < 0 || n >= (int)sizeof(b.frame)) {
+        b.len = 0;
+        telemetry_dropped++;
+        return true;
+    }
+    b.len = n;
+    return telemetryFlush(slot);
+}
+#endif
+
+/**
+ * @brief Send one event to every subscriber
+ */
+void telemetryBroadcast(const char* event, const char* data) {
+#ifdef HTTP_ASYNC_BACKEND
+    events.send(data, event, millis());
+#elif defined(ESP32)
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        if (!telemetry_clients[i].connected()) continue;
+        if (!telemetryWrite(i, event, data)) telemetry_clients[i].stop();
+    }
+#endif
+}
+
+/**
+ * @brief Build the "static" event payload
+ */
+void telemetryStaticFrame(JsonWriter& w) {
+    w.beginObject();
+    writeHardwareInfo(w);
+    w.field("interval_ms", telemetry_interval_ms);
+    w.endObject();
+}
+
+/**
+ * @brief Sample live values and emit a delta frame if anything changed
+ */
+void telemetryPush() {
+    TelemetryState now = {};
+    now.valid = true;
+    now.uptime = millis() / 1000;
+    now.heap = ESP.getFreeHeap();
+    now.tx_power = currentTxPowerDbm();
+#if LWIP_STATS && LWIP_TCP
+    now.rexmit = lwip_stats.tcp.rexmit;
+#endif
+    now.disconnects = disconnect_count;
+    now.station_count = readStations(now.stations, MAX_STATIONS);
+
+    const TelemetryState& last = telemetry_last;
+    bool full = !last.valid;
+    bool stationsChanged = full || now.station_count != last.station_count;
+    for (int i = 0; !stationsChanged && i < now.station_count; i++) {
+        stationsChanged = memcmp(now.stations[i].mac, last.stations[i].mac, 6) != 0 ||
+                          now.stations[i].rssi != last.stations[i].rssi;
+    }
+
+    JsonWriter w(telemetry_buf, sizeof(telemetry_buf));
+    w.beginObject();
+    if (full || now.uptime != last.uptime) w.field("u", now.uptime);
+    if (full || now.heap != last.heap) w.field("h", now.heap);
+    if (full || now.tx_power != last.tx_power) w.field("p", now.tx_power, 2);
+    if (full || now.rexmit != last.rexmit) w.field("x", now.rexmit);
+    if (full || now.disconnects != last.disconnects) w.field("d", now.disconnects);
+    if (stationsChanged) {
+        char macStr[18];
+        w.key("s").beginArray();
+        for (int i = 0; i < now.station_count; i++) {
+            formatMac(macStr, now.stations[i].mac);
+            w.beginArray().value(macStr).value(now.stations[i].rssi).endArray();
+        }
+        w.endArray();
+    }
+    w.endObject();
+
+    telemetry_last = now;
+    if (w.length() > 2 && !w.overflowed()) telemetryBroadcast(NULL, w.c_str());
+}
+
+/**
+ * @brief Push a frame when the interval elapsed; call from loop()
+ */
+void telemetryService() {
+    if (millis() - telemetry_last_push < telemetry_interval_ms) return;
+    telemetry_last_push = millis();
+    if (telemetrySubscribers() == 0) {
+        telemetry_last.valid = false; // Next subscriber starts from a full frame
+        return;
+    }
+    telemetryPush();
+}
+
+#if !defined(HTTP_ASYNC_BACKEND)
+/**
+ * @brief API Endpoint: Telemetry Event Stream (sync backend)
+ * Takes over the socket from WebServer and keeps it as a subscriber.
+ */
+void handleEvents(HttpRequest& req) {
+#ifdef ESP32
+    int slot = -1;
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        if (!telemetry_clients[i].connected()) { slot = i; break; }
+    }
+    if (slot < 0) {
+        req.send(503, "text/plain", "Too many subscribers");
+        return;
+    }
+
+    // WebServer drops its reference after the handler; this copy keeps the
+    // socket open. No server.send(): the stream header is written by hand.
+    WiFiClient client = server.client();
+    client.setNoDelay(true);
+    static const char header[] = "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: text/event-stream\r\n"
+                                 "Cache-Control: no-cache\r\n"
+                                 "Connection: keep-alive\r\n\r\n";
+    client.write((const uint8_t*)header, sizeof(header) - 1);
+
+    telemetry_clients[slot] = client;
+    telemetry_backlog[slot].len = telemetry_backlog[slot].sent = 0;
+    JsonWriter w(telemetry_buf, sizeof(telemetry_buf));
+    telemetryStaticFrame(w);
+    telemetryWrite(slot, "static", w.c_str());
+    telemetry_last.valid = false;
+#else
+    // ESP8266WebServer closes the socket after the handler; clients poll
+    req.send(503, "text/plain", "Event stream not supported");
+#endif
+}
+#endif
+
+/**
+ * @brief Register the event stream on whichever backend is compiled in
+ */
+void startTelemetry() {
+#ifdef HTTP_ASYNC_BACKEND
+    events.onConnect([](AsyncEventSourceClient* client) {
+        // Runs in the AsyncTCP task while telemetryPush() may be filling
+        // telemetry_buf from the HTTP task, so the frame gets its own buffer
+        char frame[sizeof(telemetry_buf)];
+        JsonWriter w(frame, sizeof(frame));
+        telemetryStaticFrame(w);
+        client->send(w.c_str(), "static", millis());
+        telemetry_last.valid = false;
+    });
+    server.addHandler(&events);
+#else
+    addRoute("/api/events", HTTP_GET, handleEvents);
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Time-series Recorder
+// -------------------------------------------------------------------------
+// Samples the traffic counters, tcp_rexmit, first-station RSSI and free heap
+// every rec_interval_ms (100 ms by default) into a fixed ring. Each sample
+// stores deltas since the previous one and flags for which test paths were
+// active, so ramp-up, stalls and retransmit bursts show up instead of a
+// single average. The ring lives in PSRAM when present (30 min at 100 ms),
+// otherwise in internal RAM (60 s).
+//
+// The ESP32 samples from an esp_timer callback, so a blocking HTTP handler
+// does not leave gaps. ESP8266 samples from loop().
+//
+// /api/recorder/export?format=csv|bin[&last_ms=N] downloads the ring. The
+// binary form is an 8-byte header ("WTS1", uint16 interval_ms, uint16 sample
+// size) followed by RecorderSample records, little endian.
+
+/**
+ * @brief One recorder sample (20 bytes)
+ */
+struct RecorderSample {
+    uint32_t t_ms;      // Uptime at the sample
+    uint32_t tx_bytes;  // Payload sent since the previous sample
+    uint32_t rx_bytes;  // Payload received since the previous sample
+    uint32_t heap;      // Free heap
+    uint16_t rexmit;    // TCP retransmits since the previous sample
+    int8_t   rssi;      // First connected station, 0 if none
+    uint8_t  flags;     // REC_* test paths active
+};
+static_assert(sizeof(RecorderSample) == 20, "RecorderSample layout is part of the export format");
+
+const uint8_t REC_DOWNLOAD = 0x01;
+const uint8_t REC_UPLOAD   = 0x02;
+const uint8_t REC_IPERF    = 0x04;
+const uint8_t REC_LATENCY  = 0x08;
+
+const uint32_t REC_PSRAM_SAMPLES = 18000;
+const uint32_t REC_RAM_SAMPLES = 600;
+
+RecorderSample* rec_buf = NULL;
+uint32_t rec_capacity = 0;
+volatile uint32_t rec_count = 0;    // Samples written since the last reset
+uint16_t rec_interval_ms = 100;
+bool rec_psram = false;
+
+/**
+ * @brief Counter values at the previous sample, for deltas
+ */
+struct RecorderLast {
+    uint64_t tx;
+    uint64_t rx;
+    uint32_t rexmit;
+};
+RecorderLast rec_last = {};
+
+#ifdef ESP32
+esp_timer_handle_t rec_timer = NULL;
+#else
+uint32_t rec_last_ms = 0;
+#endif
+
+/**
+ * @brief Take one sample; runs in the esp_timer task on ESP32
+ */
+void recorderSample(void* arg) {
+    RecorderSample smp;
+    smp.t_ms = millis();
+    smp.heap = ESP.getFreeHeap();
+    memprofSample();
+
+    StationInfo st;
+    smp.rssi = readStations(&st, 1) > 0 ? st.rssi : 0;
+
+    uint64_t tx, rx;
+    STATS_LOCK();
+    tx = traffic_tx_bytes;
+    rx = traffic_rx_bytes;
+    uint8_t flags = 0;
+    if (dl_session.bytes > 0 && dl_session.finished < dl_session.streams) flags |= REC_DOWNLOAD;
+    if (ul_session.chunks > 0 && esp_timer_get_time() - ul_session.last_us < 2000LL * rec_interval_ms) flags |= REC_UPLOAD;
+    STATS_UNLOCK();
+    if (iperf_tcp.active || iperf_udp.active) flags |= REC_IPERF;
+    if (latency_report.active) flags |= REC_LATENCY;
+    smp.flags = flags;
+
+    uint32_t rexmit = tcpRexmitCount();
+    smp.tx_bytes = tx - rec_last.tx;
+    smp.rx_bytes = rx - rec_last.rx;
+    smp.rexmit = rexmit - rec_last.rexmit;
+    rec_last = { tx, rx, rexmit };
+
+    STATS_LOCK();
+    rec_buf[rec_count % rec_capacity] = smp;
+    rec_count++;
+    STATS_UNLOCK();
+}
+
+/**
+ * @brief Clear the ring and (re)start sampling at interval_ms
+ */
+void recorderRestart(uint16_t interval_ms) {
+    rec_interval_ms = interval_ms;
+    STATS_LOCK();
+    rec_count = 0;
+    rec_last = { traffic_tx_bytes, traffic_rx_bytes, tcpRexmitCount() };
+    STATS_UNLOCK();
+#ifdef ESP32
+    esp_timer_stop(rec_timer);
+    esp_timer_start_periodic(rec_timer, (uint64_t)interval_ms * 1000);
+#else
+    rec_last_ms = millis();
+#endif
+}
+
+/**
+ * @brief Allocate the ring and start sampling
+ */
+void startRecorder() {
+#ifdef ESP32
+    if (ESP.getPsramSize() > 0) {
+        rec_buf = (RecorderSample*)heap_caps_malloc(REC_PSRAM_SAMPLES * sizeof(RecorderSample), MALLOC_CAP_SPIRAM);
+        if (rec_buf) {
+            rec_capacity = REC_PSRAM_SAMPLES;
+            rec_psram = true;
+        }
+    }
+#endif
+    if (!rec_buf) {
+        rec_buf = (RecorderSample*)malloc(REC_RAM_SAMPLES * sizeof(RecorderSample));
+        if (!rec_buf) {
+            Serial.println("Recorder: no memory");
+            return;
+        }
+        rec_capacity = REC_RAM_SAMPLES;
+    }
+#ifdef ESP32
+    esp_timer_create_args_t args = {};
+    args.callback = recorderSample;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "recorder";
+    esp_timer_create(&args, &rec_timer);
+#endif
+    recorderRestart(rec_interval_ms);
+}
+
+/**
+ * @brief ESP8266 sampling tick; ESP32 samples from its timer
+ */
+void recorderService() {
+#ifndef ESP32
+    if (!rec_buf || millis() - rec_last_ms < rec_interval_ms) return;
+    rec_last_ms += rec_interval_ms;
+    recorderSample(NULL);
+#endif
+}
+
+/**
+ * @brief Oldest sample index still held in the ring
+ */
+uint32_t recorderOldest() {
+    return rec_count > rec_capacity ? rec_count - rec_capacity : 0;
+}
+
+/**
+ * @brief Copy sample i out of the ring; false if it was overwritten
+ */
+bool recorderRead(uint32_t i, RecorderSample& out) {
+    STATS_LOCK();
+    bool ok = i >= recorderOldest() && i < rec_count;
+    if (ok) out = rec_buf[i % rec_capacity];
+    STATS_UNLOCK();
+    return ok;
+}
+#endif
+
+// -------------------------------------------------------------------------
+// Request Handlers
+// -------------------------------------------------------------------------
+
+/**
+ * @brief Serve the main HTML page
+ * The page is stored gzipped with a content hash as ETag. Browsers
+ * revalidate on each load (no-cache) and get a bodiless 304 while the
+ * firmware page is unchanged.
+ */
+void handleRoot(HttpRequest& req) {
+#if FEATURE_DASHBOARD
+    req.addHeader("ETag", INDEX_HTML_ETAG);
+    req.addHeader("Cache-Control", "no-cache");
+    if (req.header("If-None-Match") == INDEX_HTML_ETAG) {
+        req.send(304, "text/html", "");
+        return;
+    }
+    req.addHeader("Content-Encoding", "gzip");
+    req.sendProgmem(200, "text/html", index_html_gz, index_html_gz_len);
+#else
+    // Headless build: list the API instead
+    size_t n = snprintf(json_buf, sizeof(json_buf), "%s (no dashboard in this build)\n", FIRMWARE_VERSION);
+    for (int i = 0; i < route_metric_count && n < sizeof(json_buf); i++) {
+        const RouteMetrics& m = route_metrics[i];
+        n += snprintf(json_buf + n, sizeof(json_buf) - n, "%s %s\n", m.method == HTTP_POST ? "POST" : "GET", m.uri);
+    }
+    req.send(200, "text/plain", json_buf, min(n, sizeof(json_buf) - 1));
+#endif
+}
+
+/**
+ * @brief API Endpoint: Get System Status
+ * Returns JSON: { "ip": "...", "mac": "...", "uptime": 123 }
+ */
+void handleStatus(HttpRequest& req) {
+    JsonWriter w(json_buf, sizeof(json_buf));
+    char text[18];
+    uint8_t mac[6];
+
+    w.beginObject();
+    formatIp(text, WiFi.softAPIP());
+    w.field("ip", text);
+    WiFi.macAddress(mac);
+    formatMac(text, mac);
+    w.field("mac", text);
+    w.field("uptime", millis() / 1000);
+    w.field("heap", ESP.getFreeHeap());
+    w.field("min_heap", mem_boot.min_free);
+    w.field("max_block", heapLargestBlock());
+    w.field("tx_power", currentTxPowerDbm());
+    w.field("cpu_freq", ESP.getCpuFreqMHz());
+    writeHardwareInfo(w);
+    
+    #if LWIP_STATS && LWIP_TCP
+    w.field("tcp_rexmit", lwip_stats.tcp.rexmit);
+    #endif
+    w.field("disconnects", disconnect_count);
+    w.field("reset_reason", resetReasonName(bootResetReason()));
+#ifdef HTTP_ASYNC_BACKEND
+    w.field("http_backend", "async");
+#else
+    w.field("http_backend", "sync");
+#endif
+    w.field("tx_engine_port", FEATURE_TRAFFIC_ENGINES ? TX_ENGINE_PORT : 0);
+    w.field("task_layout", control_tasks ? "partitioned" : "cooperative");
+    w.field("payload_kb", tx_payload_size / 1024);
+    w.field("payload_psram", tx_payload_psram);
+    // Milliseconds since reset at each setup() stage
+    const BootTimes& b = boot_times;
+    w.key("boot").beginObject();
+    w.field("setup_ms", (uint32_t)(b.setup_us / 1000));
+    w.field("ap_up_ms", (uint32_t)(b.ap_us / 1000));
+    w.field("http_ms", (uint32_t)(b.http_us / 1000));
+    w.field("ready_ms", (uint32_t)(b.ready_us / 1000));
+    w.endObject();
+    w.key("build_features").beginArray();
+    if (FEATURE_DASHBOARD) w.value("dashboard");
+    if (FEATURE_TRAFFIC_ENGINES) w.value("traffic_engines");
+    if (FEATURE_CLIENT_TESTS) w.value("client_tests");
+    if (FEATURE_SCANNER) w.value("scanner");
+    if (FEATURE_TELEMETRY) w.value("telemetry");
+    if (FEATURE_RESULTS_LOG) w.value("results_log");
+    w.endArray();
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Captive-portal DNS statistics
+ * Replies and drops since boot and the time spent in the receive callback
+ * per reply. Datagrams lost before the callback (full tcpip mailbox) show
+ * up as lwip_udp_drops when LWIP_STATS is built in.
+ */
+void handleDns(HttpRequest& req) {
+    DnsStats st;
+    memcpy(&st, (const void*)&dns_stats, sizeof(st));
+    uint32_t replies = st.answered + st.empty;
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("port", DNS_PORT);
+    w.field("listening", dns_pcb != NULL);
+    w.field("queries", st.queries);
+    w.field("answered", st.answered);
+    w.field("empty", st.empty);
+    w.key("drops").beginObject();
+    w.field("malformed", st.malformed);
+    w.field("no_mem", st.no_mem);
+    w.field("send_errors", st.send_errors);
+#if LWIP_STATS && UDP_STATS
+    w.field("lwip_udp_drops", (uint32_t)lwip_stats.udp.drop);
+#endif
+    w.endObject();
+    w.field("latency_avg_us", replies ? (uint32_t)(st.latency_total_us / replies) : 0);
+    w.field("latency_max_us", st.latency_max_us);
+    w.field("last_query_age_ms", st.queries ? millis() - st.last_ms : 0);
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: WiFi Event Timeline
+ * Query Param: since - last seq already seen (default 0: oldest held)
+ * Returns up to TIMELINE_PAGE events after since, oldest first, with
+ * microsecond timestamps on the recorder's clock. Poll again with
+ * since=next for the rest; lost counts events overwritten before they were
+ * read.
+ */
+void handleTimeline(HttpRequest& req) {
+    uint32_t count = timeline_count.load(std::memory_order_acquire);
+    uint32_t oldest = count > (uint32_t)TIMELINE_SIZE ? count - TIMELINE_SIZE + 1 : 1;
+    uint32_t since = req.argInt("since", 0);
+    uint32_t seq = max(since + 1, oldest);
+    uint32_t lost = seq - (since + 1);
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("now_us", (unsigned long long)esp_timer_get_time());
+    w.field("count", count);
+    w.field("capacity", TIMELINE_SIZE);
+    w.field("reset_reason", resetReasonName(bootResetReason()));
+    w.field("brownout", boot_brownout);
+    w.field("disconnects", disconnect_count);
+    w.key("events").beginArray();
+    int n = 0;
+    for (; seq <= count && n < TIMELINE_PAGE; seq++) {
+        TimelineEntry e;
+        if (!timelineRead(seq, e)) {
+            lost++; // Overwritten while reading
+            continue;
+        }
+        char mac[18];
+        w.beginObject();
+        w.field("seq", seq);
+        w.field("t_us", (unsigned long long)e.t_us);
+        w.field("event", timelineEventName(e.event));
+        if (e.event == TIMELINE_BOOT) {
+            w.field("reason", e.reason);
+            w.field("reason_name", resetReasonName(e.reason));
+        } else if (e.reason) {
+            w.field("reason", e.reason);
+#ifdef ESP32
+            w.field("reason_name", WiFi.disconnectReasonName((wifi_err_reason_t)e.reason));
+#endif
+        }
+        if (e.mac[0] | e.mac[1] | e.mac[2] | e.mac[3] | e.mac[4] | e.mac[5]) {
+            formatMac(mac, e.mac);
+            w.field("mac", mac);
+        }
+        if (e.aid) w.field("aid", e.aid);
+        w.endObject();
+        n++;
+    }
+    w.endArray();
+    w.field("next", seq - 1);
+    w.field("lost", lost);
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Memory Profile
+ * Heap now and its low points since boot, in the current test run and in
+ * the previous one, plus free stack per task: the boot-time high-water mark
+ * and how much deeper the current and previous runs went (run_used, bytes).
+ */
+void handleMemory(HttpRequest& req) {
+    STATS_LOCK();
+    MemWindow boot = mem_boot;
+    MemWindow run = mem_run;
+    MemWindow last = mem_last_run;
+    STATS_UNLOCK();
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    uint32_t free = ESP.getFreeHeap();
+    uint32_t largest = heapLargestBlock();
+    w.field("free", free);
+    w.field("largest", largest);
+    w.field("fragmentation_pct", free ? 100 - largest * 100.0 / free : 0.0, 1);
+#ifdef ESP32
+    w.field("min_free_idf", ESP.getMinFreeHeap()); // Exact, tracked by the allocator
+    w.field("psram_free", ESP.getFreePsram());
+#endif
+    writeMemWindow(w, "boot", boot);
+    writeMemWindow(w, "run", run);
+    if (last.run) writeMemWindow(w, "last_run", last);
+
+    w.key("tasks").beginArray();
+    for (int i = 0; i < task_registry_count; i++) {
+        const TaskRecord& t = task_registry[i];
+        w.beginObject();
+        w.field("name", t.name);
+        w.field("stack", t.stack);
+        w.field("running", taskLive(t));
+        w.field("free_min", boot.stack_free[i]);
+        w.field("run_used", run.stack_start[i] - run.stack_free[i]);
+        if (last.run) w.field("last_run_used", last.stack_start[i] - last.stack_free[i]);
+        w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+    req.sendJson(w);
+}
+
+#if FEATURE_SCANNER
+/**
+ * @brief API Endpoint: Scan WiFi Networks
+ * Returns the cached results of the last background scan immediately:
+ *   { "age_ms": 1200, "scanning": false, "scans": 3, "networks": [...] }
+ * age_ms is -1 until the first scan completes.
+ * Query Param: refresh=1 starts a new background scan (non-blocking)
+ */
+void handleScan(HttpRequest& req) {
+    if (req.argInt("refresh", 0)) requestScan();
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    SCAN_LOCK();
+    w.beginObject();
+    w.field("age_ms", scan_cache.scans > 0 ? (long)(millis() - scan_cache.updated_ms) : -1L);
+    w.field("scanning", (bool)scan_cache.scanning);
+    w.field("scans", scan_cache.scans);
+    w.key("networks").beginArray();
+    for (int i = 0; i < scan_cache.count; ++i) {
+        const ScanEntry& e = scan_cache.entries[i];
+        w.beginObject();
+        w.field("ssid", e.ssid);
+        w.field("rssi", e.rssi);
+        w.field("channel", e.channel);
+        w.field("auth", translateEncryptionType(e.auth));
+        w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+    SCAN_UNLOCK();
+
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Channel Analyzer
+ * Returns per-channel frames, retries and busy % from the last promiscuous
+ * capture run, plus the top talkers by airtime.
+ * Query Params:
+ *   start    - 1 starts a new run (409 while a scan or run is in progress)
+ *   hop      - 0 listens on the AP channel only, default 1 (all channels)
+ *   dwell_ms - listen time per channel (20..1000), default 150
+ */
+void handleAirtime(HttpRequest& req) {
+    if (!airtimeAvailable()) {
+        req.send(501, "text/plain", "Channel analyzer not supported on this board");
+        return;
+    }
+    if (req.argInt("start", 0)) {
+        bool hop = req.argInt("hop", 1) != 0;
+        if (!requestAirtime(hop, req.argInt("dwell_ms", AIRTIME_DEFAULT_DWELL_MS))) {
+            req.send(409, "text/plain", "Radio busy with a scan, capture or STA link");
+            return;
+        }
+    }
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("running", (bool)airtime.running);
+    w.field("runs", airtime.runs);
+    if (airtime.running || airtime.runs == 0) {
+        w.endObject();
+        req.sendJson(w);
+        return;
+    }
+    w.field("age_ms", millis() - airtime.finished_ms);
+    w.field("hop", airtime.hop);
+    w.field("dwell_ms", airtime.dwell_ms);
+    w.field("ap_channel", airtime.ap_channel);
+
+    int best = 0;
+    int bestPct = 101;
+    char macStr[18];
+    w.key("channels").beginArray();
+    for (int i = 0; i < airtime.count; i++) {
+        const AirtimeChannel& c = airtime.channels[i];
+        int ch = airtime.first + i;
+        int pct = airtimeBusyPct(ch);
+        if (pct >= 0 && pct < bestPct) {
+            bestPct = pct;
+            best = ch;
+        }
+        w.beginObject();
+        w.field("channel", ch);
+        w.field("frames", c.frames);
+        w.field("bytes", c.bytes);
+        w.field("retries", c.retries);
+        w.field("mgmt", c.mgmt);
+        w.field("ctrl", c.ctrl);
+        w.field("data", c.data);
+        w.field("busy_pct", c.dwell_us ? c.airtime_us * 100.0 / c.dwell_us : 0.0, 1);
+        w.field("rssi_max", c.frames ? c.rssi_max : 0);
+        w.endObject();
+    }
+    w.endArray();
+    w.field("best_channel", best);
+    w.field("untracked", airtime.untracked);
+
+    // Top talkers by airtime; the table is small enough to select in place
+    bool taken[AIRTIME_MAX_TALKERS] = {};
+    w.key("talkers").beginArray();
+    for (int n = 0; n < AIRTIME_REPORT_TALKERS; n++) {
+        int top = -1;
+        for (int i = 0; i < airtime.talker_count; i++) {
+            if (taken[i]) continue;
+            if (top < 0 || airtime.talkers[i].airtime_us > airtime.talkers[top].airtime_us) top = i;
+        }
+        if (top < 0) break;
+        taken[top] = true;
+        const AirtimeTalker& t = airtime.talkers[top];
+        const AirtimeChannel& c = airtime.channels[t.channel - airtime.first];
+        formatMac(macStr, t.mac);
+        w.beginObject();
+        w.field("mac", macStr);
+        w.field("channel", t.channel);
+        w.field("frames", t.frames);
+        w.field("bytes", t.bytes);
+        w.field("retries", t.retries);
+        w.field("airtime_pct", c.dwell_us ? t.airtime_us * 100.0 / c.dwell_us : 0.0, 1);
+        w.field("rssi", t.rssi);
+        w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: AP Channel
+ * Returns the current channel and a congestion score per channel from the
+ * last scan and analyzer run (lower is better).
+ * Query Params:
+ *   evaluate - 1 starts a fresh scan; poll until "scanning" is false
+ *   set      - channel number, or "best", to move the AP (stations must
+ *              reassociate, so the dashboard drops for a few seconds)
+ */
+void handleChannel(HttpRequest& req) {
+    ChannelScore scores[AIRTIME_MAX_CHANNELS];
+    int count = channelScores(scores, AIRTIME_MAX_CHANNELS);
+    uint8_t current = WiFi.channel();
+    uint8_t best = channelBest(scores, count, current);
+
+    if (req.argInt("evaluate", 0)) requestScan();
+    if (req.hasArg("set")) {
+        String arg = req.arg("set");
+        long channel = arg == "best" ? best : arg.toInt();
+        if (channel < scores[0].channel || channel >= scores[0].channel + count) {
+            req.send(400, "text/plain", "Channel not allowed or nothing scanned yet");
+            return;
+        }
+        if (WiFi.status() == WL_CONNECTED) {
+            req.send(409, "text/plain", "The soft-AP follows the upstream AP's channel");
+            return;
+        }
+        channel_pending_ms = millis();
+        channel_pending = channel;
+    }
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("channel", current);
+    w.field("auto_boot", (bool)AP_AUTO_CHANNEL);
+    w.field("pending", channel_pending);
+    w.field("moves", channel_moves);
+    w.field("best", best);
+    w.field("scanning", (bool)scan_cache.scanning);
+    w.field("scan_age_ms", scan_cache.scans > 0 ? (long)(millis() - scan_cache.updated_ms) : -1L);
+    w.field("airtime_age_ms", airtime.runs > 0 && !airtime.running ? (long)(millis() - airtime.finished_ms) : -1L);
+    w.key("channels").beginArray();
+    for (int i = 0; i < count; i++) {
+        const ChannelScore& c = scores[i];
+        w.beginObject();
+        w.field("channel", c.channel);
+        w.field("networks", c.networks);
+        w.field("overlapping", c.overlapping);
+        w.field("busy_pct", c.busy_pct);
+        w.field("score", c.score);
+        w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+    req.sendJson(w);
+}
+#endif
+
+/**
+ * @brief API Endpoint: Ping
+ * HTTP round-trip fallback for the latency test where the WebSocket engine
+ * is not available. Returns simple timestamp.
+ */
+void handlePing(HttpRequest& req) {
+    req.send(200, "text/plain", String(millis()));
+}
+
+/**
+ * @brief API Endpoint: Download Test
+ * Sends a stream of dummy data to test throughput.
+ * Query Params:
+ *   size    - bytes for this stream, default 1MB
+ *   streams - number of parallel flows in the test (1..8), default 1
+ *   session - id shared by all flows of one multi-stream test
+ *   chunk   - bytes per write (256..payload size), default from the profile
+ *   sweep   - 1 records the finished session as a /api/sweep cell
+ *   duration_ms - stream for this long instead of size bytes (max 60 s)
+ */
+void handleDownload(HttpRequest& req) {
+    size_t size = req.argInt("size", 1024 * 1024); // Default 1MB
+    uint32_t durationMs = min((uint32_t)req.argInt("duration_ms", 0), MAX_TIMED_TRANSFER_MS);
+    uint32_t session = req.argInt("session", 0);
+    size_t chunk = downloadChunk(req.argInt("chunk", 0));
+    downloadSessionBegin(session, req.argInt("streams", 1), durationMs ? 0 : size, chunk, req.argInt("sweep", 0));
+    uint32_t ip = req.remoteIp();
+    stationAccount(ip, 0, 0, true);
+
+    req.sendPayload("application/octet-stream", size, chunk, [session, ip](size_t bytes, bool done) {
+        // Connection state while the streams are still saturated
+        if (done) netstatsSnapshot(pcb_download, WEB_PORT, TX_ENGINE_PORT, false);
+        downloadSessionAdd(session, bytes, done);
+        stationAccount(ip, bytes, 0);
+    }, durationMs);
+}
+
+/**
+ * @brief API Endpoint: Multi-stream Download Result
+ * Returns the device-side aggregate for the current download session.
+ */
+void handleDownloadSession(HttpRequest& req) {
+    uint32_t end = dl_session.finished >= dl_session.streams ? dl_session.end_ms : millis();
+    uint32_t duration = dl_session.bytes > 0 ? end - dl_session.start_ms : 0;
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("session", dl_session.id);
+    w.field("streams", dl_session.streams);
+    w.field("finished", dl_session.finished);
+    w.field("bytes", dl_session.bytes);
+    w.field("duration_ms", duration);
+    w.field("mbps", toMbps(dl_session.bytes, (int64_t)duration * 1000), 2);
+    w.endObject();
+    req.sendJson(w);
+}
+
+#if FEATURE_TRAFFIC_ENGINES
+/**
+ * @brief Serialize one IperfStats block as a JSON object
+ */
+void writeIperfStats(JsonWriter& w, const IperfStats& st, bool udp) {
+    uint32_t duration = st.bytes > 0 ? st.last_ms - st.start_ms : 0;
+
+    w.beginObject();
+    w.field("active", (bool)st.active);
+    w.field("runs", st.runs);
+    w.field("bytes", (uint64_t)st.bytes);
+    w.field("duration_ms", duration);
+    w.field("mbps", toMbps(st.bytes, (int64_t)duration * 1000), 2);
+    if (udp) {
+        w.field("datagrams", st.datagrams);
+        w.field("lost", st.lost);
+        w.field("out_of_order", st.out_of_order);
+        w.field("duplicates", st.duplicates);
+        w.field("reorder_max", st.reorder_max);
+        w.field("jitter_ms", st.jitter_ms, 3);
+    } else {
+        w.field("connections", st.connections);
+    }
+    w.endObject();
+}
+
+/**
+ * @brief API Endpoint: Raw iperf Server Results
+ * Returns the current/last TCP and UDP run as measured on the device.
+ */
+void handleIperf(HttpRequest& req) {
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+#ifdef ESP32
+    w.field("port", IPERF_PORT);
+#else
+    w.field("port", 0); // No raw server on ESP8266
+#endif
+    w.key("tcp");
+    writeIperfStats(w, iperf_tcp, false);
+    w.key("udp");
+    writeIperfStats(w, iperf_udp, true);
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: UDP Blast Generator
+ * Query Params:
+ *   start       - 1 starts a run (409 if one is active)
+ *   target      - receiver IPv4, default the requesting client
+ *   port        - receiver UDP port, default 5001 (iperf -s -u)
+ *   rate_kbps   - payload bitrate, default 10000
+ *   size        - UDP payload bytes (12..1472), default 1470
+ *   duration_ms - run length (100..60000), default 10000
+ *   stop        - 1 ends the current run early
+ * Returns the settings, the sender counters and, once the receiver has
+ * answered, its iperf2 report (loss, reordering, jitter).
+ */
+void handleUdpBlast(HttpRequest& req) {
+#ifdef ESP32
+    if (req.argInt("stop", 0)) blast.stop = true;
+    if (req.argInt("start", 0)) {
+        IPAddress target((uint32_t)req.remoteIp());
+        if (req.hasArg("target") && !target.fromString(req.arg("target").c_str())) {
+            req.send(400, "text/plain", "Invalid target");
+            return;
+        }
+        if (!requestBlast((uint32_t)target, req.argInt("port", BLAST_DEFAULT_PORT), req.argInt("rate_kbps", 10000),
+                          req.argInt("size", 1470), req.argInt("duration_ms", 10000))) {
+            req.send(409, "text/plain", "A blast is already running");
+            return;
+        }
+    }
+#endif
+
+    BlastReport b = blast;
+    int64_t durationUs = (b.active ? esp_timer_get_time() : b.end_us) - b.start_us;
+    if (b.sent == 0) durationUs = 0;
+    char ip[16];
+    formatIp(ip, IPAddress(b.target_ip));
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+#ifdef ESP32
+    w.field("supported", true);
+#else
+    w.field("supported", false);
+#endif
+    w.field("active", (bool)b.active);
+    w.field("runs", b.runs);
+    w.field("target", ip);
+    w.field("port", b.port);
+    w.field("size", b.size);
+    w.field("rate_kbps", b.rate_kbps);
+    w.field("duration_ms", b.duration_ms);
+    w.key("sender").beginObject();
+    w.field("datagrams", b.sent);
+    w.field("bytes", b.bytes);
+    w.field("send_errors", b.send_errors);
+    w.field("late", b.late);
+    w.field("elapsed_ms", (uint32_t)(durationUs / 1000));
+    w.field("mbps", toMbps(b.bytes, durationUs), 2);
+    w.endObject();
+    if (b.has_report) {
+        w.key("receiver").beginObject();
+        w.field("datagrams", b.rx_datagrams);
+        w.field("bytes", b.rx_bytes);
+        w.field("lost", b.rx_lost);
+        w.field("loss_pct", b.sent ? b.rx_lost * 100.0 / b.sent : 0.0, 2);
+        w.field("out_of_order", b.rx_out_of_order);
+        w.field("jitter_ms", b.rx_jitter_ms, 3);
+        w.field("mbps", toMbps(b.rx_bytes, (int64_t)b.rx_duration_ms * 1000), 2);
+        w.endObject();
+    }
+    w.endObject();
+    req.sendJson(w);
+}
+#endif
+
+#if FEATURE_CLIENT_TESTS
+/**
+ * @brief Write one client transfer as "key": {...}
+ */
+void writeClientTransfer(JsonWriter& w, const char* key, const ClientTransfer& t) {
+    w.key(key).beginObject();
+    w.field("done", t.done);
+    w.field("bytes", t.bytes);
+    w.field("duration_ms", t.duration_ms);
+    w.field("mbps", toMbps(t.bytes, (int64_t)t.duration_ms * 1000), 2);
+    w.field("error", t.error);
+    w.endObject();
+}
+
+/**
+ * @brief API Endpoint: Station-mode Link and Results
+ * Returns the upstream link, the current/last STA test run and, for
+ * comparison, the last soft-AP results measured on the device.
+ */
+void handleSta(HttpRequest& req) {
+    StaRun run = sta_run;
+    char text[18];
+    const char* phy;
+    float phyMax = staLinkMode(phy);
+    bool connected = WiFi.status() == WL_CONNECTED;
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+#ifdef ESP32
+    w.field("supported", true);
+#else
+    w.field("supported", false);
+#endif
+    w.key("link").beginObject();
+    w.field("connected", connected);
+    w.field("ssid", sta_ssid);
+    if (connected) {
+        formatIp(text, WiFi.localIP());
+        w.field("ip", text);
+        w.field("bssid", WiFi.BSSIDstr().c_str());
+        w.field("rssi", WiFi.RSSI());
+        w.field("channel", WiFi.channel());
+        w.field("phy", phy);
+        w.field("phy_max_mbps", phyMax, 1);
+    }
+    w.endObject();
+
+    w.key("run").beginObject();
+    w.field("active", (bool)run.active);
+    w.field("runs", run.runs);
+    w.field("host", run.host);
+    formatIp(text, IPAddress(run.remote_ip));
+    w.field("remote_ip", text);
+    w.field("error", run.error);
+    w.key("latency").beginObject();
+    w.field("probes", run.latency.probes);
+    w.field("failed", run.latency.failed);
+    w.field("min_us", run.latency.min_us);
+    w.field("avg_us", run.latency.avg_us);
+    w.field("max_us", run.latency.max_us);
+    w.endObject();
+    writeClientTransfer(w, "upload", run.upload);
+    writeClientTransfer(w, "download", run.download);
+    w.endObject();
+
+    // Soft-AP side, as measured by the device for the last dashboard tests
+    STATS_LOCK();
+    DownloadSession dl = dl_session;
+    UploadSession ul = ul_session;
+    STATS_UNLOCK();
+    w.key("softap").beginObject();
+    w.field("download_mbps", toMbps(dl.bytes, (int64_t)(dl.end_ms - dl.start_ms) * 1000), 2);
+    w.field("upload_mbps", ul.chunks > 1 ? toMbps(ul.bytes - ul.first_chunk, ul.last_us - ul.first_us) : 0.0f, 2);
+    w.field("latency_avg_us", latency_report.avg_us);
+    w.field("iperf_tcp_mbps", toMbps(iperf_tcp.bytes, (int64_t)(iperf_tcp.last_ms - iperf_tcp.start_ms) * 1000), 2);
+    w.endObject();
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Station-mode Control (POST)
+ * Query Params (one action per request):
+ *   action=connect&ssid=..&pass=..   join an upstream AP (soft-AP stays up)
+ *   action=disconnect                leave it
+ *   action=test&host=..[&port=5001][&http_port=80][&path=/][&duration_ms=5000]
+ *              [&tests=latency,upload,download]
+ */
+void handleStaUpdate(HttpRequest& req) {
+#ifdef ESP32
+    String action = req.arg("action");
+    if (action == "connect") {
+        String ssid = req.arg("ssid");
+        if (ssid.length() == 0 || ssid.length() >= sizeof(sta_ssid)) {
+            req.send(400, "text/plain", "SSID must be 1-32 characters");
+            return;
+        }
+        strlcpy(sta_ssid, ssid.c_str(), sizeof(sta_ssid));
+        WiFi.begin(sta_ssid, req.arg("pass").c_str());
+    } else if (action == "disconnect") {
+        WiFi.disconnect(false); // Keep the soft-AP
+    } else if (action == "test") {
+        String list = req.hasArg("tests") ? req.arg("tests") : String("latency,upload,download");
+        uint8_t tests = 0;
+        if (list.indexOf("latency") >= 0) tests |= STA_TEST_LATENCY;
+        if (list.indexOf("upload") >= 0) tests |= STA_TEST_UPLOAD;
+        if (list.indexOf("download") >= 0) tests |= STA_TEST_DOWNLOAD;
+        if (!req.hasArg("host") || tests == 0) {
+            req.send(400, "text/plain", "Expected host and tests");
+            return;
+        }
+        if (!requestStaRun(req.arg("host"), req.argInt("port", STA_DEFAULT_PORT), req.argInt("http_port", 80),
+                           req.arg("path"), req.argInt("duration_ms", STA_DEFAULT_DURATION_MS), tests)) {
+            req.send(409, "text/plain", "STA not connected or a run is active");
+            return;
+        }
+    } else {
+        req.send(400, "text/plain", "Expected connect, disconnect or test");
+        return;
+    }
+#endif
+    handleSta(req);
+}
+
+/**
+ * @brief API Endpoint: Test Sequencer Report
+ * Streams the plan, progress and per-level min/mean/max/stddev of every
+ * metric of the current or last sequence run.
+ */
+void handleSequence(HttpRequest& req) {
+    SeqCursor cursor = { 0, 0, -1, true };
+    char pending[HTTP_CHUNK_MIN];
+    int pendingLen = 0;
+    req.sendChunks("application/json", [=](uint8_t* buf, size_t maxLen) mutable -> size_t {
+        // Whole fragments only; one that does not fit waits for the next chunk
+        size_t n = 0;
+        for (;;) {
+            if (pendingLen == 0) {
+                pendingLen = seqReportNext(cursor, pending, sizeof(pending));
+                if (pendingLen <= 0) break;
+            }
+            if (n + pendingLen > maxLen) break;
+            memcpy(buf + n, pending, pendingLen);
+            n += pendingLen;
+            pendingLen = 0;
+        }
+        return n;
+    });
+}
+
+/**
+ * @brief API Endpoint: Test Sequencer Control (POST)
+ * Query Params: action=abort, or a plan (see Test Sequencer) to start:
+ *   host=..[&tests=latency,download,upload,udp][&iterations=3][&streams=1]
+ *   [&duration_ms=5000][&powers=2,5,8.5,11,13,15,17,19.5][&port=5001]
+ *   [&http_port=80][&path=/][&udp_rate_kbps=10000]
+ */
+void handleSequenceUpdate(HttpRequest& req) {
+    if (req.arg("action") == "abort") {
+        seq_run.abort = true;
+    } else {
+        SeqPlan plan;
+        seqDefaultPlan(plan);
+        for (const char* key : SEQ_PLAN_KEYS) {
+            if (req.hasArg(key) && !seqPlanSet(plan, key, req.arg(key).c_str())) {
+                char msg[40];
+                snprintf(msg, sizeof(msg), "Invalid %s", key);
+                req.send(400, "text/plain", msg);
+                return;
+            }
+        }
+        if (plan.host[0] == '\0') {
+            req.send(400, "text/plain", "Expected host");
+            return;
+        }
+        if (!requestSequence(plan)) {
+            req.send(409, "text/plain", "A sequence is running or unsupported");
+            return;
+        }
+    }
+    handleSequence(req);
+}
+
+/**
+ * @brief API Endpoint: TX Power Sweep
+ * Query Params:
+ *   start       - 1 starts a sweep over every supported TX power level
+ *   target      - peer IPv4 running iperf -s, default the requesting client
+ *   port        - its TCP port, default 5001
+ *   streams     - parallel TCP connections (1..8), default 1
+ *   duration_ms - burst length per level (1000..60000), default 3000
+ * Returns the throughput curve of the last sweep with retransmits,
+ * disconnects and RSSI per level. limit_dbm is the lowest level above the
+ * peak where throughput fell below 80% of the peak, or clients dropped.
+ */
+void handlePowerSweep(HttpRequest& req) {
+    if (req.argInt("start", 0)) {
+        SeqPlan plan;
+        seqDefaultPlan(plan);
+        IPAddress target((uint32_t)req.remoteIp());
+        if (req.hasArg("target") && !target.fromString(req.arg("target").c_str())) {
+            req.send(400, "text/plain", "Invalid target");
+            return;
+        }
+        formatIp(plan.host, target);
+        plan.tests = SEQ_TEST_DOWNLOAD;
+        plan.iterations = 1;
+        plan.duration_ms = SEQ_SWEEP_DURATION_MS;
+        plan.power_count = SEQ_SWEEP_POWER_COUNT;
+        memcpy(plan.powers, SEQ_SWEEP_POWERS, sizeof(SEQ_SWEEP_POWERS));
+        for (const char* key : { "port", "streams", "duration_ms" }) {
+            if (req.hasArg(key) && !seqPlanSet(plan, key, req.arg(key).c_str())) {
+                req.send(400, "text/plain", "Invalid sweep parameter");
+                return;
+            }
+        }
+        if (!requestSequence(plan, true)) {
+            req.send(409, "text/plain", "A sequence is running or unsupported");
+            return;
+        }
+    }
+
+    const SeqRun& r = seq_run;
+    const SeqPlan& p = r.plan;
+    int peak = -1;
+    for (int l = 0; l < p.power_count; l++) {
+        const SeqStat& s = r.levels[l].metrics[SEQ_DOWNLOAD_MBPS];
+        if (s.n && (peak < 0 || s.mean > r.levels[peak].metrics[SEQ_DOWNLOAD_MBPS].mean)) peak = l;
+    }
+    float limit = 0;
+    for (int l = peak + 1; peak >= 0 && l < p.power_count && !limit; l++) {
+        const SeqLevel& lv = r.levels[l];
+        bool measured = lv.metrics[SEQ_DOWNLOAD_MBPS].n || lv.failures;
+        bool slower = lv.metrics[SEQ_DOWNLOAD_MBPS].mean < r.levels[peak].metrics[SEQ_DOWNLOAD_MBPS].mean * SEQ_SWEEP_DROP;
+        if (measured && (slower || lv.disconnects > r.levels[peak].disconnects)) limit = p.powers[l];
+    }
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+#ifdef ESP32
+    w.field("supported", true);
+#else
+    w.field("supported", false);
+#endif
+    w.field("active", (bool)r.active);
+    w.field("sweep", r.sweep);
+    w.field("target", p.host);
+    w.field("duration_ms", p.duration_ms);
+    w.field("error", r.error);
+    w.key("levels").beginArray();
+    for (int l = 0; r.sweep && l < p.power_count; l++) {
+        const SeqLevel& lv = r.levels[l];
+        w.beginObject();
+        w.field("tx_power_dbm", p.powers[l], 2);
+        w.field("mbps", lv.metrics[SEQ_DOWNLOAD_MBPS].mean, 2);
+        w.field("retransmits", lv.retransmits);
+        w.field("disconnects", lv.disconnects);
+        w.field("rssi", lv.metrics[SEQ_RSSI_DBM].mean, 0);
+        w.field("failures", lv.failures);
+        w.endObject();
+    }
+    w.endArray();
+    if (r.sweep && peak >= 0) {
+        w.field("peak_dbm", p.powers[peak], 2);
+        w.field("peak_mbps", r.levels[peak].metrics[SEQ_DOWNLOAD_MBPS].mean, 2);
+        w.field("limit_dbm", limit, 2);
+        w.field("supply_limited", limit > 0);
+    }
+    w.endObject();
+    req.sendJson(w);
+}
+#endif
+
+/**
+ * @brief API Endpoint: Latency Engine
+ * Returns the engine ports and the current/last WebSocket latency run.
+ * ws_port is 0 where only the HTTP ping is available (ESP8266).
+ */
+void handleLatency(HttpRequest& req) {
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+#if defined(ESP32) && FEATURE_TRAFFIC_ENGINES
+    w.field("ws_port", LATENCY_WS_PORT);
+    w.field("udp_port", LATENCY_UDP_PORT);
+#else
+    w.field("ws_port", 0);
+    w.field("udp_port", 0);
+#endif
+    w.field("udp_echoes", (uint32_t)latency_udp_echoes);
+    w.key("last");
+    writeLatencyReport(w, latency_report);
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief Serialize one profile as a JSON object
+ */
+void writeProfile(JsonWriter& w, const PerfProfile& p, bool builtin) {
+    char proto[8];
+    formatProtocol(proto, p.protocol);
+    w.beginObject();
+    w.field("name", p.name);
+    w.field("builtin", builtin);
+    w.field("bandwidth", p.bandwidth);
+    w.field("protocol", proto);
+    w.field("power_save", p.power_save);
+    w.field("no_delay", p.no_delay);
+    w.field("chunk_size", p.chunk_size);
+    w.field("snd_buf_clamp", p.snd_buf_clamp);
+    w.endObject();
+}
+
+/**
+ * @brief API Endpoint: Performance Profiles (GET)
+ * Lists built-in and saved profiles, the active one, and the compiled-in
+ * limits a profile cannot change.
+ */
+void handleProfiles(HttpRequest& req) {
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("active", active_profile.name);
+    w.field("chunk_size", (uint32_t)tx_chunk_size);
+    w.key("profiles").beginArray();
+    for (int i = 0; i < BUILTIN_PROFILE_COUNT; i++) writeProfile(w, BUILTIN_PROFILES[i], true);
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        if (custom_profiles[i].name[0]) writeProfile(w, custom_profiles[i], false);
+    }
+    w.endArray();
+    w.key("fixed").beginObject();
+    w.field("tcp_snd_buf", (uint32_t)TCP_SND_BUF);
+    w.field("tcp_wnd", (uint32_t)TCP_WND);
+    w.field("tcp_mss", (uint32_t)TCP_MSS);
+#ifdef TCPIP_MBOX_SIZE
+    w.field("tcpip_mbox", TCPIP_MBOX_SIZE);
+#endif
+#ifdef DEFAULT_TCP_RECVMBOX_SIZE
+    w.field("tcp_recvmbox", DEFAULT_TCP_RECVMBOX_SIZE);
+#endif
+#if defined(CONFIG_ESP32_WIFI_AMPDU_TX_ENABLED) || defined(CONFIG_ESP_WIFI_AMPDU_TX_ENABLED)
+    w.field("ampdu_tx", true);
+#else
+    w.field("ampdu_tx", false);
+#endif
+#if defined(CONFIG_ESP32_WIFI_AMPDU_RX_ENABLED) || defined(CONFIG_ESP_WIFI_AMPDU_RX_ENABLED)
+    w.field("ampdu_rx", true);
+#else
+    w.field("ampdu_rx", false);
+#endif
+    w.endObject();
+#ifdef ESP32
+    w.field("persistent", true);
+#else
+    w.field("persistent", false); // ESP8266: until the next reboot
+#endif
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Performance Profiles (POST)
+ * Query Params (one action per request):
+ *   select=name  - apply a built-in or saved profile and remember it
+ *   save=name    - store and apply a custom profile from bandwidth=20|40,
+ *                  protocol=bgn|bg|b|bgnlr.., power_save=0|1, no_delay=0|1,
+ *                  chunk_size=bytes, snd_buf_clamp=bytes (unset: active value)
+ *   delete=name  - remove a saved profile
+ * Switching protocol or bandwidth can briefly disassociate stations.
+ */
+void handleProfileUpdate(HttpRequest& req) {
+    if (req.hasArg("select")) {
+        const PerfProfile* p = findProfile(req.arg("select").c_str());
+        if (!p) {
+            req.send(404, "text/plain", "Unknown profile");
+            return;
+        }
+        applyProfile(*p);
+        storeActiveProfile();
+    } else if (req.hasArg("save")) {
+        String name = req.arg("save");
+        if (name.length() == 0 || name.length() >= sizeof(PerfProfile::name)) {
+            req.send(400, "text/plain", "Name must be 1-15 characters");
+            return;
+        }
+        for (int i = 0; i < BUILTIN_PROFILE_COUNT; i++) {
+            if (name == BUILTIN_PROFILES[i].name) {
+                req.send(409, "text/plain", "Built-in profiles are read-only");
+                return;
+            }
+        }
+        int slot = -1;
+        for (int i = 0; i < PROFILE_SLOTS && slot < 0; i++) {
+            if (name == custom_profiles[i].name) slot = i;
+        }
+        for (int i = 0; i < PROFILE_SLOTS && slot < 0; i++) {
+            if (!custom_profiles[i].name[0]) slot = i;
+        }
+        if (slot < 0) {
+            req.send(507, "text/plain", "No free profile slot");
+            return;
+        }
+
+        PerfProfile p = active_profile;
+        strlcpy(p.name, name.c_str(), sizeof(p.name));
+        p.bandwidth = req.argInt("bandwidth", p.bandwidth) == 40 ? 40 : 20;
+        if (req.hasArg("protocol")) p.protocol = parseProtocol(req.arg("protocol"));
+        if (!p.protocol) p.protocol = PROTO_B | PROTO_G | PROTO_N;
+        p.power_save = req.argInt("power_save", p.power_save) != 0;
+        p.no_delay = req.argInt("no_delay", p.no_delay) != 0;
+        p.chunk_size = constrain(req.argInt("chunk_size", p.chunk_size), 0L, 65535L);
+        p.snd_buf_clamp = constrain(req.argInt("snd_buf_clamp", p.snd_buf_clamp), 0L, 65535L);
+        custom_profiles[slot] = p;
+        applyProfile(custom_profiles[slot]);
+        storeProfileSlot(slot);
+        storeActiveProfile();
+    } else if (req.hasArg("delete")) {
+        String name = req.arg("delete");
+        int slot = -1;
+        for (int i = 0; i < PROFILE_SLOTS && slot < 0; i++) {
+            if (custom_profiles[i].name[0] && name == custom_profiles[i].name) slot = i;
+        }
+        if (slot < 0) {
+            req.send(404, "text/plain", "Unknown profile");
+            return;
+        }
+        custom_profiles[slot].name[0] = '\0';
+        storeProfileSlot(slot);
+        if (name == active_profile.name) {
+            applyProfile(BUILTIN_PROFILES[0]);
+            storeActiveProfile();
+        }
+    } else {
+        req.send(400, "text/plain", "Expected select, save or delete");
+        return;
+    }
+    handleProfiles(req);
+}
+
+/**
+ * @brief API Endpoint: lwIP Statistics
+ * Returns the global lwIP counters, memory-pool usage and what changed
+ * since the current run started:
+ *   { "lwip_stats": true, "counters": {...},
+ *     "run": { "type": "download", "age_ms": 5200, "diff": {...} },
+ *     "memp": [ { "name": "PBUF_POOL", "avail": .., "used": .., "max": .., "err": .., "err_run": .. } ] }
+ * Query Param: mark=1 starts a manual run window.
+ */
+void handleNetstats(HttpRequest& req) {
+    if (req.argInt("mark", 0)) netstatsMark("manual");
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+#if LWIP_STATS
+    w.field("lwip_stats", true);
+    w.key("counters").beginObject();
+    for (int i = 0; i < NET_COUNTER_COUNT; i++) w.field(NET_COUNTERS[i].name, (uint32_t)*NET_COUNTERS[i].value);
+    w.endObject();
+#else
+    w.field("lwip_stats", false); // Counters compiled out of this lwIP build
+#endif
+
+    w.key("run").beginObject();
+    w.field("type", net_mark.run);
+    w.field("age_ms", millis() - net_mark.at_ms);
+#if LWIP_STATS
+    w.key("diff").beginObject();
+    for (int i = 0; i < NET_COUNTER_COUNT; i++) {
+        // Counters wrap at their native width (16 bit unless LWIP_STATS_LARGE)
+        NetCounterValue d = *NET_COUNTERS[i].value - (NetCounterValue)net_mark.counters[i];
+        w.field(NET_COUNTERS[i].name, (uint32_t)d);
+    }
+    w.endObject();
+#endif
+    w.endObject();
+
+#if LWIP_STATS && MEMP_STATS
+    w.key("memp").beginArray();
+    for (int i = 0; i < MEMP_MAX; i++) {
+        const stats_mem* m = lwip_stats.memp[i];
+        if (!m) continue;
+        w.beginObject();
+        w.field("name", MEMP_NAMES[i]);
+        w.field("avail", (uint32_t)m->avail);
+        w.field("used", (uint32_t)m->used);
+        w.field("max", (uint32_t)m->max);
+        w.field("err", (uint32_t)m->err);
+        w.field("err_run", (uint32_t)(m->err - net_mark.memp_err[i]));
+        w.endObject();
+    }
+    w.endArray();
+#endif
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Per-connection TCP State
+ * set=live (default) snapshots every active connection now; set=download
+ * returns the web/TX-engine connections captured as the last download
+ * stream finished, when cwnd and windows still reflect the saturated flow.
+ */
+void handleNetstatsPcbs(HttpRequest& req) {
+    static const char* const TCP_STATES[] = {
+        "CLOSED", "LISTEN", "SYN_SENT", "SYN_RCVD", "ESTABLISHED", "FIN_WAIT_1",
+        "FIN_WAIT_2", "CLOSE_WAIT", "CLOSING", "LAST_ACK", "TIME_WAIT"
+    };
+    bool download = req.arg("set") == "download";
+    if (!download) netstatsSnapshot(pcb_live, 0, 0, false);
+    const PcbTable& t = download ? pcb_download : pcb_live;
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    char ip[16];
+    w.beginObject();
+    w.field("set", download ? "download" : "live");
+    w.field("age_ms", t.taken_ms ? (long)(millis() - t.taken_ms) : -1L);
+    w.key("pcbs").beginArray();
+    for (int i = 0; i < t.count; i++) {
+        const PcbSnapshot& p = t.pcbs[i];
+        formatIp(ip, IPAddress(p.remote_ip));
+        w.beginObject();
+        w.field("local_port", p.local_port);
+        w.field("remote", ip);
+        w.field("remote_port", p.remote_port);
+        w.field("state", p.state <= TIME_WAIT ? TCP_STATES[p.state] : "?");
+        w.field("cwnd", p.cwnd);
+        w.field("ssthresh", p.ssthresh);
+        w.field("snd_wnd", p.snd_wnd);
+        w.field("rcv_wnd", p.rcv_wnd);
+        w.field("snd_buf", p.snd_buf);
+        w.field("snd_queuelen", p.snd_queuelen);
+        w.field("mss", p.mss);
+        w.field("srtt_ms", p.srtt_ms);
+        w.field("rto_ms", p.rto_ms);
+        w.field("nrtx", p.nrtx);
+        w.field("dupacks", p.dupacks);
+        w.field("fast_recovery", p.fast_recovery);
+        w.field("ooseq", p.ooseq);
+        w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+    req.sendJson(w);
+}
+
+#if FEATURE_TELEMETRY
+/**
+ * @brief API Endpoint: Time-series Recorder Status
+ * Query Param: interval_ms=50..1000 clears the ring and changes the
+ * sampling period.
+ */
+void handleRecorder(HttpRequest& req) {
+    if (req.hasArg("interval_ms") && rec_buf) {
+        recorderRestart(constrain(req.argInt("interval_ms", 100), 50L, 1000L));
+    }
+    uint32_t held = rec_count - recorderOldest();
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("interval_ms", rec_interval_ms);
+    w.field("capacity", rec_capacity);
+    w.field("samples", held);
+    w.field("span_ms", held * rec_interval_ms);
+    w.field("psram", rec_psram);
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Time-series Recorder Export
+ * Query Params:
+ *   format  - csv (default) or bin
+ *   last_ms - only the most recent window, default everything held
+ */
+void handleRecorderExport(HttpRequest& req) {
+    uint32_t end = rec_count;
+    uint32_t first = recorderOldest();
+    long lastMs = req.argInt("last_ms", 0);
+    if (lastMs > 0) {
+        uint32_t want = lastMs / rec_interval_ms + 1;
+        if (end - first > want) first = end - want;
+    }
+    int64_t intervalUs = (int64_t)rec_interval_ms * 1000;
+
+    if (req.arg("format") == "bin") {
+        req.addHeader("Content-Disposition", "attachment; filename=\"timeseries.bin\"");
+        bool header = true;
+        req.sendChunks("application/octet-stream", [=](uint8_t* buf, size_t maxLen) mutable -> size_t {
+            size_t n = 0;
+            if (header) {
+                memcpy(buf, "WTS1", 4);
+                uint16_t meta[2] = { rec_interval_ms, (uint16_t)sizeof(RecorderSample) };
+                memcpy(buf + 4, meta, sizeof(meta));
+                n = 8;
+                header = false;
+            }
+            RecorderSample smp;
+            for (; first < end && maxLen - n >= sizeof(smp); first++) {
+                if (!recorderRead(first, smp)) continue; // Overwritten while streaming
+                memcpy(buf + n, &smp, sizeof(smp));
+                n += sizeof(smp);
+            }
+            return n;
+        });
+        return;
+    }
+
+    req.addHeader("Content-Disposition", "attachment; filename=\"timeseries.csv\"");
+    bool header = true;
+    req.sendChunks("text/csv", [=](uint8_t* buf, size_t maxLen) mutable -> size_t {
+        const size_t ROW_MAX = 80;
+        char* out = (char*)buf;
+        size_t n = 0;
+        if (header) {
+            n = snprintf(out, maxLen, "t_ms,tx_bytes,rx_bytes,tx_mbps,rx_mbps,tcp_rexmit,rssi,heap,flags\n");
+            header = false;
+        }
+        RecorderSample smp;
+        for (; first < end && maxLen - n >= ROW_MAX; first++) {
+            if (!recorderRead(first, smp)) continue;
+            n += snprintf(out + n, maxLen - n, "%u,%u,%u,%.2f,%.2f,%u,%d,%u,%u\n",
+                          (unsigned)smp.t_ms, (unsigned)smp.tx_bytes, (unsigned)smp.rx_bytes,
+                          toMbps(smp.tx_bytes, intervalUs), toMbps(smp.rx_bytes, intervalUs),
+                          smp.rexmit, smp.rssi, (unsigned)smp.heap, smp.flags);
+        }
+        return n;
+    });
+}
+#endif
+
+#if FEATURE_RESULTS_LOG
+/**
+ * @brief Size of a results file in whole records, 0 if missing
+ */
+size_t resultsFileSize(const char* path) {
+    if (!LittleFS.exists(path)) return 0;
+    File f = LittleFS.open(path, "r");
+    if (!f) return 0;
+    size_t size = f.size();
+    f.close();
+    return size - size % sizeof(ResultRecord);
+}
+
+/**
+ * @brief API Endpoint: Results Log
+ * Returns record counts and flash use of the persistent results log.
+ * Query Param: clear=1 deletes both log files.
+ */
+void handleResults(HttpRequest& req) {
+    if (req.argInt("clear", 0) && results.mounted) {
+        STATS_LOCK();
+        results.queued = 0;
+        STATS_UNLOCK();
+        LittleFS.remove(RESULTS_OLD_PATH);
+        LittleFS.remove(RESULTS_PATH);
+    }
+    size_t held = resultsFileSize(RESULTS_OLD_PATH) + resultsFileSize(RESULTS_PATH);
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("mounted", results.mounted);
+    w.field("boot", results.boot);
+    w.field("next_seq", results.next_seq);
+    w.field("records", (uint32_t)(held / sizeof(ResultRecord)));
+    w.field("written", results.written);
+    w.field("queued", results.queued);
+    w.field("dropped", results.dropped);
+    w.field("write_errors", results.write_errors);
+    w.field("record_bytes", (uint32_t)sizeof(ResultRecord));
+    w.field("max_bytes", (uint32_t)(RESULTS_LOG_MAX_BYTES * 2));
+#ifdef ESP32
+    if (results.mounted) {
+        w.field("fs_total", (uint32_t)LittleFS.totalBytes());
+        w.field("fs_used", (uint32_t)LittleFS.usedBytes());
+    }
+#endif
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Results Log Export
+ * Streams both log files, oldest record first, as CSV. Records are read
+ * from flash a few at a time, so the log is never held in RAM.
+ */
+void handleResultsExport(HttpRequest& req) {
+    const char* paths[2] = { RESULTS_OLD_PATH, RESULTS_PATH };
+    size_t sizes[2] = { resultsFileSize(RESULTS_OLD_PATH), resultsFileSize(RESULTS_PATH) };
+    int file = 0;
+    size_t offset = 0;
+    bool header = true;
+    req.addHeader("Content-Disposition", "attachment; filename=\"results.csv\"");
+    req.sendChunks("text/csv", [=](uint8_t* buf, size_t maxLen) mutable -> size_t {
+        const size_t ROW_MAX = 112;
+        const int BATCH = 8;
+        char* out = (char*)buf;
+        size_t n = 0;
+        if (header) {
+            n = snprintf(out, maxLen, "seq,boot,uptime_ms,type,p1,p2,v1,v2,v3\n");
+            header = false;
+        }
+        while (file < 2 && maxLen - n >= ROW_MAX) {
+            if (offset >= sizes[file]) {
+                file++;
+                offset = 0;
+                continue;
+            }
+            // Only as many records as this chunk has room for
+            ResultRecord batch[BATCH];
+            size_t want = min((size_t)BATCH, min((maxLen - n) / ROW_MAX, (sizes[file] - offset) / sizeof(ResultRecord)));
+            File f = LittleFS.open(paths[file], "r");
+            size_t got = f && f.seek(offset) ? f.read((uint8_t*)batch, want * sizeof(ResultRecord)) / sizeof(ResultRecord) : 0;
+            if (f) f.close();
+            if (got == 0) {
+                file++; // Rotated or unreadable while streaming
+                offset = 0;
+                continue;
+            }
+            offset += got * sizeof(ResultRecord);
+            for (size_t i = 0; i < got; i++) {
+                const ResultRecord& r = batch[i];
+                n += snprintf(out + n, maxLen - n, "%u,%u,%u,%s,%u,%u,%.3f,%.3f,%.3f\n",
+                              (unsigned)r.seq, r.boot, (unsigned)r.uptime_ms,
+                              r.type < RESULT_TYPE_COUNT ? RESULT_TYPE_NAMES[r.type] : "unknown",
+                              (unsigned)r.param[0], (unsigned)r.param[1], r.value[0], r.value[1], r.value[2]);
+            }
+        }
+        return n;
+    });
+}
+#endif
+
+/**
+ * @brief API Endpoint: Sweep Results
+ * Returns the recorded cells, oldest first:
+ *   { "cells": [ { "dir": "D", "chunk": 4096, "size": 1048576, "streams": 1,
+ *                  "mbps": 18.2, "duration_ms": 440, "rexmit": 0 } ] }
+ * Query Param: clear=1 empties the table before a new sweep.
+ */
+void handleSweep(HttpRequest& req) {
+    if (req.argInt("clear", 0)) {
+        STATS_LOCK();
+        sweep_count = 0;
+        STATS_UNLOCK();
+    }
+    uint32_t first = sweep_count > SWEEP_MAX_CELLS ? sweep_count - SWEEP_MAX_CELLS : 0;
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("payload_size", (uint32_t)tx_payload_size);
+    w.key("cells").beginArray();
+    for (uint32_t i = first; i < sweep_count; i++) {
+        const SweepCell& c = sweep_cells[i % SWEEP_MAX_CELLS];
+        char dir[2] = { c.dir, '\0' };
+        w.beginObject();
+        w.field("dir", dir);
+        w.field("chunk", c.chunk);
+        w.field("size", c.size);
+        w.field("streams", c.streams);
+        w.field("mbps", toMbps(c.bytes, c.duration_us), 2);
+        w.field("duration_ms", c.duration_us / 1000);
+        w.field("rexmit", c.rexmit);
+        w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Upload Test
+ * Receives data to test upload throughput.
+ */
+void handleUpload(HttpRequest& req) {
+    req.send(200, "text/plain", "OK");
+}
+
+/**
+ * @brief Upload body sink: data is dropped as it arrives
+ */
+void discardUploadBody(HttpRequest& req, const uint8_t* data, size_t len, size_t index, size_t total) {
+}
+
+/**
+ * @brief Raw upload body sink: counts and timestamps each read, then drops it
+ */
+void countUploadBody(HttpRequest& req, const uint8_t* data, size_t len, size_t index, size_t total) {
+    uploadSessionAdd(req.argInt("session", 0), req.argInt("streams", 1), len);
+    stationAccount(req.remoteIp(), 0, len, index == 0);
+}
+
+/**
+ * @brief API Endpoint: Raw Upload Sink
+ * Accepts an application/octet-stream body (no multipart) and returns the
+ * receive rate measured on the device.
+ * Query Params: streams, session, sweep (as for /api/download)
+ *   more - 1 when the same stream posts another body after this one; a
+ *          timed upload ends each stream with an empty more=0 post
+ */
+void handleUploadRaw(HttpRequest& req) {
+    bool more = req.argInt("more", 0);
+    STATS_LOCK();
+    if (!more) ul_session.finished++;
+    UploadSession st = ul_session;
+    STATS_UNLOCK();
+
+    // The first chunk only marks the start; it arrived before the clock ran
+    uint32_t durationUs = st.chunks > 1 ? st.last_us - st.first_us : 0;
+    uint64_t timed = st.bytes - st.first_chunk;
+    if (!more && st.finished == st.streams && st.chunks > 1) {
+        uint32_t rexmit = tcpRexmitCount() - st.rexmit_start;
+        if (req.argInt("sweep", 0)) {
+            sweepRecord('U', timed / (st.chunks - 1), st.bytes / st.streams, st.streams, timed, durationUs, rexmit);
+        }
+        resultsLog(RESULT_UPLOAD, st.streams, timed / (st.chunks - 1), toMbps(timed, durationUs), st.bytes / 1e6f,
+                   rexmit);
+    }
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("session", st.id);
+    w.field("streams", st.streams);
+    w.field("finished", st.finished);
+    w.field("bytes", st.bytes);
+    w.field("chunks", st.chunks);
+    w.field("duration_us", durationUs);
+    w.field("mbps", toMbps(timed, durationUs), 2);
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Full-duplex Result
+ * Query Params: download, upload - session ids of the two halves of a
+ * full-duplex run (download streams and raw uploads started together).
+ * Returns the device-side rate of each direction, how long they overlapped
+ * and the retransmits since the earlier one began. The first query that
+ * finds both sessions complete logs the run.
+ */
+void handleDuplex(HttpRequest& req) {
+    static uint32_t logged_dl = 0, logged_ul = 0;
+    uint32_t dlId = req.argInt("download", 0);
+    uint32_t ulId = req.argInt("upload", 0);
+    STATS_LOCK();
+    DownloadSession dl = dl_session;
+    UploadSession ul = ul_session;
+    STATS_UNLOCK();
+    if (dl.id != dlId || ul.id != ulId) {
+        req.send(404, "text/plain", "Unknown session (another test ran since)");
+        return;
+    }
+
+    bool dlDone = dl.finished >= dl.streams;
+    bool ulDone = ul.finished >= ul.streams;
+    uint32_t dlEnd = dlDone ? dl.end_ms : millis();
+    int64_t dlUs = dl.bytes > 0 ? (int64_t)(dlEnd - dl.start_ms) * 1000 : 0;
+    int64_t ulUs = ul.chunks > 1 ? ul.last_us - ul.first_us : 0;
+    float dlMbps = toMbps(dl.bytes, dlUs);
+    float ulMbps = toMbps(ul.bytes - ul.first_chunk, ulUs);
+
+    // Both windows on the millisecond clock (millis() follows esp_timer)
+    int64_t ulStart = ul.first_us / 1000, ulEnd = ul.last_us / 1000;
+    int64_t overlap = min((int64_t)dlEnd, ulEnd) - max((int64_t)dl.start_ms, ulStart);
+    uint32_t rexmit = tcpRexmitCount() - min(dl.rexmit_start, ul.rexmit_start);
+
+    bool complete = dlDone && ulDone;
+    if (complete && (dlId != logged_dl || ulId != logged_ul)) {
+        logged_dl = dlId;
+        logged_ul = ulId;
+        resultsLog(RESULT_DUPLEX, dl.streams, ul.streams, dlMbps, ulMbps, rexmit);
+    }
+
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("complete", complete);
+    w.key("download").beginObject();
+    w.field("streams", dl.streams);
+    w.field("bytes", dl.bytes);
+    w.field("duration_ms", (uint32_t)(dlUs / 1000));
+    w.field("mbps", dlMbps, 2);
+    w.endObject();
+    w.key("upload").beginObject();
+    w.field("streams", ul.streams);
+    w.field("bytes", ul.bytes);
+    w.field("duration_ms", (uint32_t)(ulUs / 1000));
+    w.field("mbps", ulMbps, 2);
+    w.endObject();
+    w.field("aggregate_mbps", dlMbps + ulMbps, 2);
+    w.field("overlap_ms", (uint32_t)max(overlap, (int64_t)0));
+    w.field("rexmit", rexmit);
+    w.endObject();
+    req.sendJson(w);
+}
+
+/**
+ * @brief API Endpoint: Get Connected Clients (AP Mode)
+ * Returns JSON array of connected stations with RSSI, PHY mode and the
+ * traffic each one moved (ip, tx/rx bytes, sessions, active).
+ */
+void handleClients(HttpRequest& req) {
+    JsonWriter w(json_buf, sizeof(json_buf));
+    StationInfo stations[MAX_STATIONS];
+    int count = readStations(stations, MAX_STATIONS);
+    char macStr[18];
+    char ipStr[16];
+    char phy[8];
+
+    w.beginArray();
+    for (int i = 0; i < count; i++) {
+        formatMac(macStr, stations[i].mac);
+        formatProtocol(phy, stations[i].phy);
+        w.beginObject();
+        w.field("mac", macStr);
+        w.field("rssi", stations[i].rssi);
+        w.field("phy", phy);
+        StationStats st;
+        if (stationLookup(stations[i].mac, st)) {
+            formatIp(ipStr, IPAddress(st.ip));
+            w.field("ip", ipStr);
+            w.field("tx_bytes", st.tx_bytes);
+            w.field("rx_bytes", st.rx_bytes);
+            w.field("sessions", st.sessions);
+            w.field("active", millis() - st.last_ms < STATION_ACTIVE_MS);
+        }
+        w.endObject();
+    }
+    w.endArray();
+    req.sendJson(w);
+}
+
+/**
+ * @brief One metric family of /api/metrics, exported per route
+ */
+struct MetricFamily {
+    const char* name;
+    const char* type;
+    const char* help;
+};
+
+const MetricFamily METRIC_FAMILIES[] = {
+    { "wifitest_http_requests_total", "counter", "Handler runs per route" },
+    { "wifitest_http_response_bytes_total", "counter", "Response body bytes per route" },
+    { "wifitest_http_request_duration_seconds", "histogram", "Dispatch to handler return" },
+    { "wifitest_http_request_duration_min_seconds", "gauge", "Fastest handler run" },
+    { "wifitest_http_request_duration_avg_seconds", "gauge", "Mean handler run" },
+    { "wifitest_http_request_duration_max_seconds", "gauge", "Slowest handler run" },
+    { "wifitest_http_request_duration_p99_seconds", "gauge", "99th percentile (bucket upper bound)" },
+};
+const int METRIC_FAMILY_COUNT = sizeof(METRIC_FAMILIES) / sizeof(METRIC_FAMILIES[0]);
+
+/**
+ * @brief Position of the /api/metrics writer between chunks
+ */
+struct MetricsCursor {
+    int family;
+    int route;      // -1: the family's HELP/TYPE lines
+    int line;
+};
+
+/**
+ * @brief Format line `line` of one family for route m
+ * @return Length written, 0 once the route has no more lines
+ */
+int metricsRouteLine(char* out, size_t cap, int family, const RouteMetrics& m, int line) {
+    const char* name = METRIC_FAMILIES[family].name;
+    const char* method = m.method == HTTP_POST ? "POST" : "GET";
+    if (family == 2) {
+        // Cumulative buckets, then +Inf, _sum and _count
+        if (line < ROUTE_LATENCY_BUCKETS) {
+            uint32_t cumulative = 0;
+            for (int b = 0; b <= line; b++) cumulative += m.buckets[b];
+            return snprintf(out, cap, "%s_bucket{route=\"%s\",method=\"%s\",le=\"%g\"} %u\n",
+                            name, m.uri, method, ROUTE_BUCKET_US[line] / 1e6, (unsigned)cumulative);
+        }
+        switch (line - ROUTE_LATENCY_BUCKETS) {
+            case 0: return snprintf(out, cap, "%s_bucket{route=\"%s\",method=\"%s\",le=\"+Inf\"} %u\n",
+                                    name, m.uri, method, (unsigned)m.calls);
+            case 1: return snprintf(out, cap, "%s_sum{route=\"%s\",method=\"%s\"} %.6f\n",
+                                    name, m.uri, method, m.total_us / 1e6);
+            case 2: return snprintf(out, cap, "%s_count{route=\"%s\",method=\"%s\"} %u\n",
+                                    name, m.uri, method, (unsigned)m.calls);
+            default: return 0;
+        }
+    }
+    if (line > 0) return 0;
+    switch (family) {
+        case 0: return snprintf(out, cap, "%s{route=\"%s\",method=\"%s\"} %u\n", name, m.uri, method, (unsigned)m.calls);
+        case 1: return snprintf(out, cap, "%s{route=\"%s\",method=\"%s\"} %llu\n", name, m.uri, method,
+                                (unsigned long long)m.bytes);
+    }
+    uint32_t us;
+    switch (family) {
+        case 3:  us = m.min_us; break;
+        case 4:  us = m.calls ? m.total_us / m.calls : 0; break;
+        case 5:  us = m.max_us; break;
+        default: us = routeP99(m); break;
+    }
+    return snprintf(out, cap, "%s{route=\"%s\",method=\"%s\"} %.6f\n", name, m.uri, method, us / 1e6);
+}
+
+/**
+ * @brief Next line of the exposition, family by family; 0 at the end
+ */
+int metricsNextLine(MetricsCursor& c, char* out, size_t cap) {
+    while (c.family < METRIC_FAMILY_COUNT) {
+        const MetricFamily& f = METRIC_FAMILIES[c.family];
+        if (c.route < 0) {
+            if (c.line++ == 0) return snprintf(out, cap, "# HELP %s %s\n", f.name, f.help);
+            c.route = 0;
+            c.line = 0;
+            return snprintf(out, cap, "# TYPE %s %s\n", f.name, f.type);
+        }
+        if (c.route < route_metric_count) {
+            int n = metricsRouteLine(out, cap, c.family, route_metrics[c.route], c.line++);
+            if (n > 0) return n;
+            c.route++;
+            c.line = 0;
+            continue;
+        }
+        c.family++;
+        c.route = -1;
+        c.line = 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief API Endpoint: Route Metrics
+ * Prometheus text exposition of call counts, response bytes and handler
+ * latency (histogram plus min/avg/max/p99) for every registered route.
+ */
+void handleMetrics(HttpRequest& req) {
+    MetricsCursor cursor = { 0, -1, 0 };
+    char pending[HTTP_CHUNK_MIN];
+    int pendingLen = 0;
+    req.sendChunks("text/plain; version=0.0.4", [=](uint8_t* buf, size_t maxLen) mutable -> size_t {
+        // Whole lines only; one that does not fit waits for the next chunk
+        size_t n = 0;
+        for (;;) {
+            if (pendingLen == 0) {
+                pendingLen = metricsNextLine(cursor, pending, sizeof(pending));
+                if (pendingLen <= 0) break;
+                if (pendingLen >= (int)sizeof(pending)) {
+                    // Truncated: keep the line terminated
+                    pendingLen = sizeof(pending) - 1;
+                    pending[pendingLen - 1] = '\n';
+                }
+            }
+            if (n + pendingLen > maxLen) break;
+            memcpy(buf + n, pending, pendingLen);
+            n += pendingLen;
+            pendingLen = 0;
+        }
+        return n;
+    });
+}
+
+#if FEATURE_TELEMETRY
+/**
+ * @brief API Endpoint: Telemetry Settings
+ * Query Param: interval_ms - push period for /api/events (>= 100)
+ */
+void handleTelemetry(HttpRequest& req) {
+    if (req.hasArg("interval_ms")) {
+        telemetry_interval_ms = max((uint32_t)req.argInt("interval_ms", 500), TELEMETRY_MIN_INTERVAL_MS);
+    }
+    JsonWriter w(json_buf, sizeof(json_buf));
+    w.beginObject();
+    w.field("interval_ms", telemetry_interval_ms);
+    w.field("subscribers", telemetrySubscribers());
+#if !defined(HTTP_ASYNC_BACKEND) && defined(ESP32)
+    w.field("dropped", telemetry_dropped);
+#endif
+    w.endObject();
+    req.sendJson(w);
+}
+#endif
+
+/**
+ * @brief Handle 404 errors
+ */
+void handleNotFound(HttpRequest& req) {
+    if (req.host() != WiFi.softAPIP().toString()) {
+        req.addHeader("Location", String("http://") + WiFi.softAPIP().toString());
+        req.send(302, "text/plain", "");
+    } else {
+        req.send(404, "text/plain", "404: Not Found");
+    }
+}
+
+// -------------------------------------------------------------------------
+// Control Tasks
+// -------------------------------------------------------------------------
+// On dual-core chips HTTP gets a task on CONTROL_CORE, next to the WiFi
+// driver, and loop() exits so TRAFFIC_CORE is left to the traffic tasks.
+// A saturating iperf or latency run then no longer competes with
+// /api/status, and there is no fixed delay()
+// between requests. With the async backend the AsyncTCP task serves HTTP
+// (pinned via CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini) and the
+// HTTP task only pushes telemetry.
+//
+// Single-core chips (C3, S2) and ESP8266 keep the cooperative loop().
+// Captive-portal DNS needs neither: it answers from the lwIP callback.
+
+#ifdef ESP32
+/**
+ * @brief HTTP control endpoints and telemetry push
+ */
+void httpTask(void* arg) {
+    for (;;) {
+#ifdef HTTP_ASYNC_BACKEND
+        vTaskDelay(pdMS_TO_TICKS(10));
+#else
+        server.handleClient();
+        // handleClient() only sleeps when no client is pending; while a
+        // connection is open it just yields, so give IDLE and the
+        // low-priority tasks a tick on every pass.
+        vTaskDelay(1);
+#endif
+#if FEATURE_TELEMETRY
+        telemetryService();
+#else
+        memprofService();
+#endif
+#if FEATURE_SCANNER
+        channelService();
+#endif
+#if FEATURE_CLIENT_TESTS
+        seqSerialService();
+#endif
+    }
+}
+#endif
+
+/**
+ * @brief Move HTTP servicing off loop() on dual-core chips
+ */
+void startControlTasks() {
+#ifdef ESP32
+    if (ESP.getChipCores() < 2) {
+        Serial.println("Task layout: cooperative loop (single core)");
+        return;
+    }
+    control_tasks = startTask(httpTask, "http", 8192, HTTP_TASK_PRIORITY, CONTROL_CORE);
+    Serial.printf("Task layout: control on core %d, traffic on core %d\n", CONTROL_CORE, TRAFFIC_CORE);
+#endif
+}
+
+// -------------------------------------------------------------------------
+// Main Setup & Loop
+// -------------------------------------------------------------------------
+
+void setup() {
+    boot_times.setup_us = esp_timer_get_time();
+
+    // Initialize Serial for debugging
+    Serial.begin(115200);
+    delay(1000);
+    Serial.println("\n\n--- ESP32 WiFi Tester Starting ---");
+
+    // Persistent results log, mounted before any test can finish
+    startResultsLog();
+
+    // Reset reason first, then every WiFi event, on the timeline
+    startTimeline();
+
+    // Register Event Handler
+#ifdef ESP32
+    WiFi.onEvent(onWiFiEvent);
+#else
+    stationConnectHandler = WiFi.onStationModeConnected(onStationConnected);
+    stationDisconnectHandler = WiFi.onStationModeDisconnected(onStationDisconnected);
+    stationGotIpHandler = WiFi.onStationModeGotIP(onStationGotIp);
+    stationDhcpTimeoutHandler = WiFi.onStationModeDHCPTimeout(onStationDhcpTimeout);
+    softAPConnectHandler = WiFi.onSoftAPModeStationConnected(onSoftAPConnected);
+    softAPDisconnectHandler = WiFi.onSoftAPModeStationDisconnected(onSoftAPDisconnected);
+#endif
+
+    // Set WiFi Mode to AP_STA (Access Point + Station)
+    // Station mode is required for scanning to work properly while AP is active
+    WiFi.mode(WIFI_AP_STA);
+
+    // Disable WiFi Power Save Mode to maximize throughput
+#ifdef ESP32
+    WiFi.setSleep(false);
+#else
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+#endif
+
+    // Background scanner and channel analyzer; both run before the AP
+    // starts when it picks its own channel
+#if FEATURE_SCANNER
+    startScanner();
+    startAirtimeAnalyzer();
+    uint8_t channel = bootChannel();
+#else
+    uint8_t channel = AP_CHANNEL;
+#endif
+
+    // Configure Access Point
+    Serial.print("Setting up Access Point... ");
+    if (WiFi.softAP(AP_SSID, AP_PASS, channel)) {
+        boot_times.ap_us = esp_timer_get_time();
+        Serial.println("Success");
+        Serial.print("AP IP Address: ");
+        Serial.println(WiFi.softAPIP());
+        Serial.print("SSID: ");
+        Serial.println(AP_SSID);
+        Serial.printf("Channel: %u\n", channel);
+    } else {
+        Serial.println("Failed!");
+    }
+
+    // Captive-portal DNS (answers all names with this IP)
+    startCaptiveDns(WiFi.softAPIP());
+
+#if FEATURE_SCANNER
+    // The first scan runs before any client joins
+    if (scan_cache.scans == 0) requestScan();
+#endif
+
+    // Raw TCP/UDP sink for iperf2 clients, independent of the web server,
+    // and the paced UDP generator beside it
+    startIperfServer();
+    startBlastGenerator();
+
+    // Client-side tests through an upstream AP (STA interface), and the
+    // headless sequencer built on the same client probes
+#if FEATURE_CLIENT_TESTS
+    startStaTests();
+    startSequencer();
+#endif
+
+#if FEATURE_TELEMETRY
+    // Time-series sampling of traffic, retransmits, RSSI and heap
+    startRecorder();
+#endif
+
+    // Microsecond RTT probes over WebSocket, plus a UDP echo port
+    startLatencyEngine();
+
+    // Zero-copy raw-API download engine
+    initTxPayload();
+    startTxEngine();
+
+    // Radio and TCP tuning from the saved performance profile
+    startProfiles();
+
+    // Setup Web Server Routes
+    addRoute("/", HTTP_GET, handleRoot);
+    addRoute("/api/status", HTTP_GET, handleStatus);
+#if FEATURE_SCANNER
+    addRoute("/api/scan", HTTP_GET, handleScan);
+    addRoute("/api/airtime", HTTP_GET, handleAirtime);
+    addRoute("/api/channel", HTTP_GET, handleChannel);
+#endif
+    addRoute("/api/ping", HTTP_GET, handlePing);
+    addRoute("/api/download", HTTP_GET, handleDownload);
+    addRoute("/api/download/session", HTTP_GET, handleDownloadSession);
+    addRoute("/api/upload", HTTP_POST, handleUpload, discardUploadBody);
+    addRoute("/api/upload/raw", HTTP_POST, handleUploadRaw, countUploadBody, BODY_RAW);
+    addRoute("/api/duplex", HTTP_GET, handleDuplex);
+    addRoute("/api/clients", HTTP_GET, handleClients);
+#if FEATURE_TRAFFIC_ENGINES
+    addRoute("/api/iperf", HTTP_GET, handleIperf);
+    addRoute("/api/udpblast", HTTP_GET, handleUdpBlast);
+#endif
+#if FEATURE_CLIENT_TESTS
+    addRoute("/api/sta", HTTP_GET, handleSta);
+    addRoute("/api/sta", HTTP_POST, handleStaUpdate);
+#endif
+    addRoute("/api/latency", HTTP_GET, handleLatency);
+#if FEATURE_TELEMETRY
+    addRoute("/api/recorder", HTTP_GET, handleRecorder);
+    addRoute("/api/recorder/export", HTTP_GET, handleRecorderExport);
+#endif
+    addRoute("/api/netstats", HTTP_GET, handleNetstats);
+    addRoute("/api/netstats/pcbs", HTTP_GET, handleNetstatsPcbs);
+    addRoute("/api/profile", HTTP_GET, handleProfiles);
+    addRoute("/api/sweep", HTTP_GET, handleSweep);
+    addRoute("/api/profile", HTTP_POST, handleProfileUpdate);
+#if FEATURE_TELEMETRY
+    addRoute("/api/telemetry", HTTP_GET, handleTelemetry);
+#endif
+    addRoute("/api/metrics", HTTP_GET, handleMetrics);
+    addRoute("/api/memory", HTTP_GET, handleMemory);
+#if FEATURE_CLIENT_TESTS
+    addRoute("/api/sequence", HTTP_GET, handleSequence);
+    addRoute("/api/sequence", HTTP_POST, handleSequenceUpdate);
+    addRoute("/api/powersweep", HTTP_GET, handlePowerSweep);
+#endif
+#if FEATURE_RESULTS_LOG
+    addRoute("/api/results", HTTP_GET, handleResults);
+    addRoute("/api/results/export", HTTP_GET, handleResultsExport);
+#endif
+    addRoute("/api/timeline", HTTP_GET, handleTimeline);
+    addRoute("/api/dns", HTTP_GET, handleDns);
+#if FEATURE_TELEMETRY
+    startTelemetry();
+#endif
+    setNotFoundHandler(handleNotFound);
+
+    // Start Server
+    startHttpServer();
+    boot_times.http_us = esp_timer_get_time();
+    Serial.println("HTTP server started");
+
+    // HTTP task on dual-core chips
+    startControlTasks();
+
+    // Heap and stack watermarks; needs the final task list
+    startMemoryProfiler();
+
+    boot_times.ready_us = esp_timer_get_time();
+    bootTimesPrint();
+}
+
+void loop() {
+#ifdef ESP32
+    if (control_tasks) {
+        // Everything runs in pinned tasks; free this core for traffic
+        vTaskDelete(NULL);
+    }
+#endif
+
+#if FEATURE_SCANNER
+    // Collect background scan results (single-core chips)
+    scanService();
+
+    // Apply a channel move requested via /api/channel
+    channelService();
+#endif
+
+#if FEATURE_TELEMETRY
+    // Push live telemetry to event-stream subscribers
+    telemetryService();
+
+    // Time-series samples (ESP8266; ESP32 uses a timer)
+    recorderService();
+#else
+    // Heap low points, otherwise sampled with the recorder
+    memprofService();
+#endif
+
+#if FEATURE_CLIENT_TESTS
+    // Test plans typed on the serial console
+    seqSerialService();
+#endif
+
+    // Append queued results to flash (ESP8266; ESP32 uses a task)
+    resultsService();
+
+#ifdef HTTP_ASYNC_BACKEND
+    // HTTP is serviced by the AsyncTCP task; loop() only runs the
+    // background services above.
+    delay(1);
+#else
+    // Handle incoming client requests
+    server.handleClient();
+    
+    // Add a small delay to prevent CPU hogging if needed, 
+    // though handleClient is usually sufficient.
+    delay(2); 
+#endif
 }
\ No newline at end of file